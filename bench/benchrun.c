@@ -0,0 +1,213 @@
+// The benchmark suite runner behind make bench. Every script runs a number of times as its own clox process
+// and we keep the median wall time and the peak resident memory of the worst run. Instructions executed
+// come from one more run in this process with a --profile counter attached, which is exact and doesn't
+// depend on the machine. The results go to stdout as tab separated columns, one script per line, and
+// next to the stored baseline when there is one, so a regression shows up as a ratio above 1.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/common.h"
+#include "../headers/profile.h"
+#include "../headers/vm.h"
+
+#define MAX_SCRIPTS 64
+
+typedef struct {
+  char name[256];
+  double milliseconds;
+  unsigned long long instructions;
+  long peakKilobytes;
+} Result;
+
+static char* readFile(const char* path, size_t* length) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  *length = ftell(file);
+  rewind(file);
+
+  char* buffer = malloc(*length);
+  if (buffer == NULL || fread(buffer, 1, *length, file) < *length) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  fclose(file);
+  return buffer;
+}
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// One run of the interpreter with its output thrown away. Returns the wall time, the peak memory goes
+// into peakKilobytes if it's the highest so far.
+static double runProcess(const char* interpreter, const char* path, long* peakKilobytes) {
+  double start = now();
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    exit(70);
+  }
+  if (pid == 0) {
+    // dup2() rather than freopen(), which would flush our own buffered report into the child's copy of stdout.
+    int devNull = open("/dev/null", O_WRONLY);
+    dup2(devNull, STDOUT_FILENO);
+    execl(interpreter, interpreter, path, (char*)NULL);
+    _exit(127);
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s %s failed.\n", interpreter, path);
+    exit(70);
+  }
+  double elapsed = now() - start;
+  // ru_maxrss is in kilobytes on Linux
+  if (usage.ru_maxrss > *peakKilobytes) *peakKilobytes = usage.ru_maxrss;
+  return elapsed;
+}
+
+static unsigned long long countInstructions(const char* path) {
+  size_t length;
+  char* source = readFile(path, &length);
+
+  VM vm;
+  initVM(&vm);
+  vm.out = fopen("/dev/null", "w");
+  vm.profile = newProfile(false);
+  if (interpret(&vm, source, length) != INTERPRET_OK) exit(70);
+
+  unsigned long long total = 0;
+  for (int op = 0; op < UINT8_COUNT; op++) total += vm.profile->counts[op];
+
+  freeProfile(vm.profile);
+  fclose(vm.out);
+  freeVM(&vm);
+  free(source);
+  return total;
+}
+
+static int compareTimes(const void* a, const void* b) {
+  double left = *(const double*)a;
+  double right = *(const double*)b;
+  return left < right ? -1 : left > right ? 1 : 0;
+}
+
+static Result measure(const char* interpreter, const char* path, int runs) {
+  Result result;
+  snprintf(result.name, sizeof(result.name), "%s", path);
+  result.peakKilobytes = 0;
+
+  double* times = malloc(sizeof(double) * runs);
+  for (int i = 0; i < runs; i++) times[i] = runProcess(interpreter, path, &result.peakKilobytes);
+  qsort(times, runs, sizeof(double), compareTimes);
+  result.milliseconds = (runs % 2 == 1 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2) * 1000;
+  free(times);
+
+  result.instructions = countInstructions(path);
+  return result;
+}
+
+// Reads a file this program wrote with -w. Returns how many results it found, 0 if there's no file.
+static int readBaseline(const char* path, Result* baseline) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL) return 0;
+
+  char line[512];
+  int count = 0;
+  while (fgets(line, sizeof(line), file) != NULL && count < MAX_SCRIPTS) {
+    if (line[0] == '#' || strncmp(line, "script\t", 7) == 0) continue;
+    Result* result = &baseline[count];
+    if (sscanf(line, "%255[^\t]\t%lf\t%llu\t%ld", result->name, &result->milliseconds,
+               &result->instructions, &result->peakKilobytes) == 4) {
+      count++;
+    }
+  }
+  fclose(file);
+  return count;
+}
+
+static Result* findBaseline(Result* baseline, int count, const char* name) {
+  for (int i = 0; i < count; i++) {
+    if (strcmp(baseline[i].name, name) == 0) return &baseline[i];
+  }
+  return NULL;
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: benchrun [-n runs] [-i interpreter] [-b baseline.tsv | -w baseline.tsv] script...\n");
+  exit(64);
+}
+
+int main(int argc, char* argv[]) {
+  int runs = 5;
+  const char* interpreter = "./main";
+  const char* baselinePath = NULL;
+  const char* writePath = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "n:i:b:w:")) != -1) {
+    switch (option) {
+      case 'n': runs = atoi(optarg); break;
+      case 'i': interpreter = optarg; break;
+      case 'b': baselinePath = optarg; break;
+      case 'w': writePath = optarg; break;
+      default: usage();
+    }
+  }
+  if (optind == argc || runs < 1 || argc - optind > MAX_SCRIPTS) usage();
+
+  Result baseline[MAX_SCRIPTS];
+  int baselineCount = baselinePath != NULL ? readBaseline(baselinePath, baseline) : 0;
+  if (baselinePath != NULL && baselineCount == 0) {
+    fprintf(stderr, "No baseline in \"%s\", make bench-baseline writes one.\n", baselinePath);
+  }
+
+  FILE* out = stdout;
+  if (writePath != NULL) {
+    out = fopen(writePath, "w");
+    if (out == NULL) {
+      fprintf(stderr, "Could not open file \"%s\".\n", writePath);
+      exit(74);
+    }
+    fprintf(out, "# %s, median of %d runs\n", interpreter, runs);
+  }
+
+  fprintf(out, "script\tmedian_ms\tinstructions\tpeak_kb");
+  if (baselineCount > 0) fprintf(out, "\tbaseline_ms\ttime_ratio\tbaseline_instructions\tbaseline_peak_kb");
+  fputc('\n', out);
+
+  for (int i = optind; i < argc; i++) {
+    Result result = measure(interpreter, argv[i], runs);
+    fprintf(out, "%s\t%.3f\t%llu\t%ld", result.name, result.milliseconds, result.instructions, result.peakKilobytes);
+
+    if (baselineCount > 0) {
+      Result* before = findBaseline(baseline, baselineCount, result.name);
+      if (before == NULL) {
+        fprintf(out, "\t-\t-\t-\t-");
+      } else {
+        fprintf(out, "\t%.3f\t%.3f\t%llu\t%ld", before->milliseconds, result.milliseconds / before->milliseconds,
+                before->instructions, before->peakKilobytes);
+      }
+    }
+    fputc('\n', out);
+    fflush(out);
+  }
+
+  if (out != stdout) fclose(out);
+  return 0;
+}
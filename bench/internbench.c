@@ -0,0 +1,131 @@
+// Contention benchmark for the shared intern set. Every thread gets a VM of its own and interns the
+// same pool of strings over and over, once with each VM on its own vm.strings table and once with all of
+// them on the process-wide set. The first round is all inserts racing each other, the rest are lookups.
+// It also reports how much string memory each additional VM costs either way. The report goes to stderr.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/common.h"
+#include "../headers/intern.h"
+#include "../headers/object.h"
+#include "../headers/table.h"
+#include "../headers/vm.h"
+
+typedef struct {
+  char** pool;
+  int poolSize;
+  int rounds;
+  bool shared;
+  size_t bytes; // string memory the thread's VM owns once it's done
+} Worker;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// What the VM's own strings cost, the objects, their characters and the intern table.
+static size_t stringBytes(VM* vm) {
+  size_t bytes = sizeof(Entry) * vm->strings.capacity;
+  for (Obj* object = vm->objects; object != NULL; object = object->next) {
+    ObjString* string = (ObjString*)object;
+    bytes += sizeof(ObjString) + string->length + 1;
+  }
+  return bytes;
+}
+
+static void* work(void* argument) {
+  Worker* worker = (Worker*)argument;
+  VM vm;
+  initVM(&vm);
+  vm.sharedStrings = worker->shared;
+
+  for (int round = 0; round < worker->rounds; round++) {
+    for (int i = 0; i < worker->poolSize; i++) {
+      copyString(&vm, worker->pool[i], (int)strlen(worker->pool[i]));
+    }
+  }
+
+  worker->bytes = stringBytes(&vm);
+  freeVM(&vm);
+  return NULL;
+}
+
+typedef struct {
+  double seconds;
+  size_t bytes; // summed over every VM
+} Result;
+
+static Result measure(char** pool, int poolSize, int rounds, int threads, bool shared) {
+  if (shared) initSharedStrings(poolSize * 2);
+
+  pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+  Worker* workers = malloc(sizeof(Worker) * threads);
+  double start = now();
+  for (int i = 0; i < threads; i++) {
+    workers[i] = (Worker){pool, poolSize, rounds, shared, 0};
+    pthread_create(&ids[i], NULL, work, &workers[i]);
+  }
+
+  Result result = {0, 0};
+  for (int i = 0; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+    result.bytes += workers[i].bytes;
+  }
+  result.seconds = now() - start;
+
+  if (shared) {
+    // The set itself is shared by all of them, count it once.
+    for (int i = 0; i < poolSize; i++) {
+      result.bytes += sizeof(ObjString) + strlen(pool[i]) + 1;
+    }
+    freeSharedStrings();
+  }
+
+  free(ids);
+  free(workers);
+  return result;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc > 4) {
+    fprintf(stderr, "Usage: internbench [strings] [rounds] [max threads]\n");
+    exit(64);
+  }
+
+  int poolSize = argc >= 2 ? atoi(argv[1]) : 5000;
+  int rounds = argc >= 3 ? atoi(argv[2]) : 200;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int maxThreads = argc == 4 ? atoi(argv[3]) : (int)(cores < 1 ? 1 : cores);
+
+  // Identifier-like names, the kind of strings every VM running the same scripts ends up with.
+  char** pool = malloc(sizeof(char*) * poolSize);
+  for (int i = 0; i < poolSize; i++) {
+    char name[32];
+    snprintf(name, sizeof(name), "identifier_%d", i);
+    pool[i] = strdup(name);
+  }
+
+  fprintf(stderr, "%d strings, %d rounds per thread, %ld cores\n", poolSize, rounds, cores);
+  for (int threads = 1; threads <= maxThreads;
+       threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+    double operations = (double)threads * rounds * poolSize;
+    Result local = measure(pool, poolSize, rounds, threads, false);
+    Result shared = measure(pool, poolSize, rounds, threads, true);
+
+    fprintf(stderr, "threads %3d   local %7.1f Mops/s %9zu bytes/VM   shared %7.1f Mops/s %9zu bytes/VM\n",
+            threads,
+            operations / local.seconds / 1e6, local.bytes / threads,
+            operations / shared.seconds / 1e6, shared.bytes / threads);
+  }
+
+  for (int i = 0; i < poolSize; i++) free(pool[i]);
+  free(pool);
+  return 0;
+}
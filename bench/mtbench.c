@@ -0,0 +1,156 @@
+// Runs a script over and over on several threads at once, each thread with a VM of its own.
+// Every thread seeds its VM with a different threadSeed global and checks the result the script leaves
+// behind against a single threaded reference run, so any state shared between interpreters shows up as
+// a wrong answer. Each thread count runs twice, once compiling the source on every run with interpret() and
+// once with every thread running the same Script compiled up front. The report goes to stderr: runs per
+// second for each thread count, and the speedup over one.
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/common.h"
+#include "../headers/object.h"
+#include "../headers/script.h"
+#include "../headers/table.h"
+#include "../headers/vm.h"
+
+typedef struct {
+  const char* source;
+  size_t length;
+  const Script* script; // NULL to compile the source on every run
+  int runs;
+  int seed;
+  bool ok;
+} Worker;
+
+static char* readFile(const char* path, size_t* length) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  *length = ftell(file);
+  rewind(file);
+
+  char* buffer = malloc(*length);
+  if (buffer == NULL || fread(buffer, 1, *length, file) < *length) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  fclose(file);
+  return buffer;
+}
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void setGlobal(VM* vm, const char* name, Value value) {
+  tableSet(&vm->globals, copyString(vm, name, (int)strlen(name)), value);
+}
+
+static bool getGlobal(VM* vm, const char* name, Value* value) {
+  return tableGet(&vm->globals, copyString(vm, name, (int)strlen(name)), value);
+}
+
+// Runs the script once in a fresh VM and returns the number it leaves in result.
+static double runOnce(Worker* worker, bool* ok) {
+  VM vm;
+  initVM(&vm);
+  setGlobal(&vm, "threadSeed", NUMBER_VAL(worker->seed));
+
+  InterpretResult status = worker->script != NULL ? runScript(&vm, worker->script)
+                                                  : interpret(&vm, worker->source, worker->length);
+  Value result;
+  *ok = status == INTERPRET_OK && getGlobal(&vm, "result", &result) && IS_NUMBER(result);
+  double number = *ok ? AS_NUMBER(result) : 0;
+  freeVM(&vm);
+  return number;
+}
+
+static void* work(void* argument) {
+  Worker* worker = (Worker*)argument;
+  bool ok;
+  double expected = runOnce(worker, &ok);
+  worker->ok = ok;
+
+  for (int i = 0; i < worker->runs && worker->ok; i++) {
+    double result = runOnce(worker, &ok);
+    if (!ok || result != expected) worker->ok = false;
+  }
+  return NULL;
+}
+
+// Runs `runs` scripts on each of `threads` threads and returns the wall time it took.
+static double measure(const char* source, size_t length, const Script* script, int threads, int runs, bool* ok) {
+  pthread_t* ids = malloc(sizeof(pthread_t) * threads);
+  Worker* workers = malloc(sizeof(Worker) * threads);
+
+  double start = now();
+  for (int i = 0; i < threads; i++) {
+    workers[i] = (Worker){source, length, script, runs, i + 1, false};
+    pthread_create(&ids[i], NULL, work, &workers[i]);
+  }
+  *ok = true;
+  for (int i = 0; i < threads; i++) {
+    pthread_join(ids[i], NULL);
+    if (!workers[i].ok) *ok = false;
+  }
+  double elapsed = now() - start;
+
+  free(ids);
+  free(workers);
+  return elapsed;
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "Usage: mtbench path [runs per thread] [max threads]\n");
+    exit(64);
+  }
+
+  int runs = argc >= 3 ? atoi(argv[2]) : 200;
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int maxThreads = argc == 4 ? atoi(argv[3]) : (int)(cores < 1 ? 1 : cores);
+  size_t length;
+  char* source = readFile(argv[1], &length);
+
+  VM settings;
+  initVM(&settings);
+  Script* script = compileScript(&settings, source, length);
+  if (script == NULL) exit(65);
+
+  fprintf(stderr, "%s, %d runs per thread, %ld cores\n", argv[1], runs, cores);
+  double single = 0;
+  double singleScript = 0;
+  bool allOk = true;
+  // Doubling the threads each time, but always finishing on the maximum even when it isn't a power of two.
+  for (int threads = 1; threads <= maxThreads;
+       threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2) {
+    bool ok, scriptOk;
+    double throughput = threads * runs / measure(source, length, NULL, threads, runs, &ok);
+    double scriptThroughput = threads * runs / measure(source, length, script, threads, runs, &scriptOk);
+    if (threads == 1) {
+      single = throughput;
+      singleScript = scriptThroughput;
+    }
+
+    fprintf(stderr, "threads %3d   interpret %10.0f runs/s %5.2fx   script %10.0f runs/s %5.2fx   %s\n",
+            threads, throughput, throughput / single, scriptThroughput, scriptThroughput / singleScript,
+            ok && scriptOk ? "results ok" : "RESULTS DIFFER");
+    if (!ok || !scriptOk) allOk = false;
+  }
+
+  freeScript(script);
+  freeVM(&settings);
+  free(source);
+  return allOk ? 0 : 70;
+}
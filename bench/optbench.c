@@ -0,0 +1,91 @@
+// Compiles a script once, then runs it over and over with and without the optimizing tier.
+// Only the execution is timed, the single pass compiler runs the same either way.
+// The script's own output goes to stdout, the report goes to stderr.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../headers/common.h"
+#include "../headers/chunk.h"
+#include "../headers/compiler.h"
+#include "../headers/optimizer.h"
+#include "../headers/vm.h"
+
+static char* readFile(const char* path, size_t* length) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  fseek(file, 0L, SEEK_END);
+  *length = ftell(file);
+  rewind(file);
+
+  char* buffer = malloc(*length);
+  if (buffer == NULL || fread(buffer, 1, *length, file) < *length) {
+    fprintf(stderr, "Could not read file \"%s\".\n", path);
+    exit(74);
+  }
+  fclose(file);
+  return buffer;
+}
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int countInstructions(Chunk* chunk) {
+  int count = 0;
+  for (int offset = 0; offset < chunk->count; count++) {
+    int length = instructionLength(chunk->code[offset]);
+    offset += length > 0 ? length : 1;
+  }
+  return count;
+}
+
+static void measure(const char* label, const char* source, size_t length, bool optimize, int runs) {
+  VM vm;
+  initVM(&vm);
+
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(&vm, source, length, &chunk)) exit(65);
+
+  double start = now();
+  if (optimize) optimizeChunk(&chunk);
+  double optimizeTime = now() - start;
+
+  start = now();
+  for (int i = 0; i < runs; i++) {
+    if (runChunk(&vm, &chunk) != INTERPRET_OK) exit(70);
+  }
+  double runTime = now() - start;
+
+  fprintf(stderr, "%-6s instructions %8d   run %9.3f ms   optimize %7.3f ms\n",
+          label, countInstructions(&chunk), runTime * 1000 / runs, optimizeTime * 1000);
+
+  freeChunk(&chunk);
+  freeVM(&vm);
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: optbench path [runs]\n");
+    exit(64);
+  }
+
+  int runs = argc == 3 ? atoi(argv[2]) : 200;
+  size_t length;
+  char* source = readFile(argv[1], &length);
+
+  fprintf(stderr, "%s, %d runs\n", argv[1], runs);
+  measure("plain", source, length, false, runs);
+  measure("-O", source, length, true, runs);
+
+  free(source);
+  return 0;
+}
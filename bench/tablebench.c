@@ -0,0 +1,219 @@
+// Micro-benchmark for table.c and string interning, the hash tables every global access and every string
+// goes through. It drives each operation on its own over a pool of generated keys and reports ns/op,
+// then the probe statistics of the tables it built, so alternative table designs can be compared directly.
+// The probe statistics come from the finished table layout, nothing in table.c is instrumented.
+//
+//   -n keys        distinct keys (default 100000)
+//   -l length      characters per key (default 16)
+//   -h ratio       fraction of lookups that hit (default 0.9)
+//   -d churn       fraction of the keys deleted and reinserted per round (default 0.1)
+//   -r rounds      how often every timed pass repeats (default 10)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../headers/common.h"
+#include "../headers/memory.h"
+#include "../headers/object.h"
+#include "../headers/table.h"
+#include "../headers/vm.h"
+
+typedef struct {
+  int keys;
+  int length;
+  double hitRatio;
+  double churn;
+  int rounds;
+} Options;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void report(const char* operation, double seconds, long operations) {
+  printf("%-22s %10.1f ns/op %12ld ops\n", operation, seconds * 1e9 / operations, operations);
+}
+
+// Keys with a shared prefix, the way identifiers in real code tend to look, padded out to the length.
+static char** makeKeys(int count, int length, const char* prefix) {
+  char** keys = malloc(sizeof(char*) * count);
+  for (int i = 0; i < count; i++) {
+    keys[i] = malloc(length + 1);
+    int written = snprintf(keys[i], length + 1, "%s%d_", prefix, i);
+    for (int j = written; j < length; j++) keys[i][j] = (char)('a' + (i * 31 + j) % 26);
+    keys[i][length] = '\0';
+  }
+  return keys;
+}
+
+// How far every key sits from its home bucket, and how far a miss starting at each bucket has to walk.
+static void probeStats(const char* name, Table* table) {
+  int used = 0, tombstones = 0;
+  long hitProbes = 0, maxProbe = 0, missProbes = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    if (entry->key == NULL) {
+      if (!IS_NIL(entry->value)) tombstones++;
+    } else {
+      used++;
+      int home = (int)(entry->key->hash % table->capacity);
+      long distance = (i - home + table->capacity) % table->capacity + 1;
+      hitProbes += distance;
+      if (distance > maxProbe) maxProbe = distance;
+    }
+
+    // A miss stops at the first bucket that's neither a key nor a tombstone.
+    long walk = 1;
+    for (int j = i; table->entries[j].key != NULL || !IS_NIL(table->entries[j].value);
+         j = (j + 1) % table->capacity) {
+      walk++;
+      if (walk > table->capacity) break;
+    }
+    missProbes += walk;
+  }
+
+  printf("%-10s capacity %8d keys %8d tombstones %7d load %.2f   probes hit %.2f avg %ld max   miss %.2f avg\n",
+         name, table->capacity, used, tombstones, (double)table->count / table->capacity,
+         used == 0 ? 0.0 : (double)hitProbes / used, maxProbe,
+         table->capacity == 0 ? 0.0 : (double)missProbes / table->capacity);
+}
+
+static void run(Options* options) {
+  int n = options->keys;
+  char** keys = makeKeys(n, options->length, "key_");
+  char** missing = makeKeys(n, options->length, "absent_");
+  int* lengths = malloc(sizeof(int) * n);
+  for (int i = 0; i < n; i++) lengths[i] = (int)strlen(keys[i]);
+
+  VM vm;
+  initVM(&vm);
+  ObjString** strings = malloc(sizeof(ObjString*) * n);
+  ObjString** absent = malloc(sizeof(ObjString*) * n);
+
+  // Interning: the first pass allocates every string, later ones only look them up.
+  double start = now();
+  for (int i = 0; i < n; i++) strings[i] = copyString(&vm, keys[i], lengths[i]);
+  report("copyString new", now() - start, n);
+
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    for (int i = 0; i < n; i++) copyString(&vm, keys[i], lengths[i]);
+  }
+  report("copyString interned", now() - start, (long)n * options->rounds);
+
+  // takeString on a string that's already interned frees the buffer it was handed, the usual concatenation case.
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    for (int i = 0; i < n; i++) {
+      char* chars = ALLOCATE(char, lengths[i] + 1);
+      memcpy(chars, keys[i], lengths[i] + 1);
+      takeString(&vm, chars, lengths[i]);
+    }
+  }
+  report("takeString interned", now() - start, (long)n * options->rounds);
+
+  for (int i = 0; i < n; i++) absent[i] = copyString(&vm, missing[i], options->length);
+
+  // Which lookups hit is decided up front, so the pattern is the same for every table operation.
+  bool* hits = malloc(sizeof(bool) * n);
+  srand(41);
+  for (int i = 0; i < n; i++) hits[i] = rand() < options->hitRatio * RAND_MAX;
+
+  // The absent keys got interned above, so a miss looks for one of them minus its first character,
+  // under a hash none of the interned strings has.
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    for (int i = 0; i < n; i++) {
+      tableFindString(&vm.strings, hits[i] ? keys[i] : missing[i] + 1, lengths[i] - (hits[i] ? 0 : 1),
+                      hits[i] ? strings[i]->hash : absent[i]->hash ^ 1);
+    }
+  }
+  report("tableFindString", now() - start, (long)n * options->rounds);
+
+  // A table like the globals, keyed on interned strings.
+  Table table;
+  initTable(&table);
+  start = now();
+  for (int i = 0; i < n; i++) tableSet(&table, strings[i], NUMBER_VAL(i));
+  report("tableSet new", now() - start, n);
+
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    for (int i = 0; i < n; i++) tableSet(&table, strings[i], NUMBER_VAL(round));
+  }
+  report("tableSet existing", now() - start, (long)n * options->rounds);
+
+  Value value;
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    for (int i = 0; i < n; i++) tableGet(&table, hits[i] ? strings[i] : absent[i], &value);
+  }
+  report("tableGet", now() - start, (long)n * options->rounds);
+
+  // Churn leaves tombstones behind, which is what the probe statistics below are mostly about.
+  int churned = (int)(n * options->churn);
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    for (int i = 0; i < churned; i++) {
+      int victim = (i * 7919 + round * 104729) % n;
+      tableDelete(&table, strings[victim]);
+      tableSet(&table, strings[victim], NUMBER_VAL(i));
+    }
+  }
+  if (churned > 0) report("tableDelete + tableSet", now() - start, (long)churned * options->rounds * 2);
+
+  start = now();
+  for (int round = 0; round < options->rounds; round++) {
+    Table copy;
+    initTable(&copy);
+    tableAddAll(&table, &copy);
+    freeTable(&copy);
+  }
+  report("tableAddAll per entry", now() - start, (long)n * options->rounds);
+
+  putchar('\n');
+  probeStats("table", &table);
+  probeStats("strings", &vm.strings);
+
+  freeTable(&table);
+  freeVM(&vm);
+  for (int i = 0; i < n; i++) {
+    free(keys[i]);
+    free(missing[i]);
+  }
+  free(keys);
+  free(missing);
+  free(lengths);
+  free(strings);
+  free(absent);
+  free(hits);
+}
+
+int main(int argc, char* argv[]) {
+  Options options = {100000, 16, 0.9, 0.1, 10};
+  int option;
+  while ((option = getopt(argc, argv, "n:l:h:d:r:")) != -1) {
+    switch (option) {
+      case 'n': options.keys = atoi(optarg); break;
+      case 'l': options.length = atoi(optarg); break;
+      case 'h': options.hitRatio = atof(optarg); break;
+      case 'd': options.churn = atof(optarg); break;
+      case 'r': options.rounds = atoi(optarg); break;
+      default:
+        fprintf(stderr, "Usage: tablebench [-n keys] [-l key length] [-h hit ratio] [-d delete churn] [-r rounds]\n");
+        exit(64);
+    }
+  }
+  // Long enough for the prefix and the longest index.
+  if (options.length < 16) options.length = 16;
+
+  printf("%d keys of %d characters, %.0f%% hits, %.0f%% churn, %d rounds\n",
+         options.keys, options.length, options.hitRatio * 100, options.churn * 100, options.rounds);
+  run(&options);
+  return 0;
+}
@@ -0,0 +1,399 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../headers/aot.h"
+#include "../headers/array.h"
+#include "../headers/memory.h"
+
+// Where the headers and libclox.a live, the makefile passes in the checkout the driver was built from.
+#ifndef CLOX_ROOT
+#define CLOX_ROOT "."
+#endif
+
+// ______________ Runtime for the generated code __________________________
+
+InterpretResult aotError(VM* vm, int line, const char* format, ...) {
+  flushOutput(vm);
+  va_list args;
+  va_start(args, format);
+  vfprintf(vm->err, format, args);
+  va_end(args);
+  fputs("\n", vm->err);
+  fprintf(vm->err, "[line %d] in script\n", line);
+  return INTERPRET_RUNTIME_ERROR;
+}
+
+Value aotString(VM* vm, const char* chars, int length) {
+  return OBJ_VAL(copyString(vm, chars, length));
+}
+
+// Numbers are written out bit for bit, so every constant, even the folded infinities and NaNs, comes back exact.
+Value aotNumber(uint64_t bits) {
+  double number;
+  memcpy(&number, &bits, sizeof(double));
+  return NUMBER_VAL(number);
+}
+
+// The slow half of OP_ADD, a = a + b when both are strings or slices.
+bool aotAdd(VM* vm, Value* a, Value b) {
+  if (!isText(*a) || !isText(b)) return false;
+  push(vm, *a);
+  push(vm, b);
+  concatenate(vm);
+  *a = pop(vm);
+  return true;
+}
+
+// OP_CALL, the callee sits just below args. Returns false once the error has been reported.
+bool aotCall(VM* vm, Value* args, int argCount, int line) {
+  Value callee = args[-1];
+  if (!IS_NATIVE(callee)) {
+    aotError(vm, line, "Can only call functions.");
+    return false;
+  }
+
+  ObjNative* native = AS_NATIVE(callee);
+  if (native->arity >= 0 && argCount != native->arity) {
+    aotError(vm, line, "Expected %d arguments but got %d.", native->arity, argCount);
+    return false;
+  }
+
+  const char* error = native->function(vm, argCount, args);
+  if (error != NULL) {
+    aotError(vm, line, "%s", error);
+    return false;
+  }
+  return true;
+}
+
+Value aotArray(VM* vm, Value* values, int count) {
+  return OBJ_VAL(buildArray(vm, values, count));
+}
+
+bool aotGetIndex(VM* vm, Value* sp, int line) {
+  const char* error = getIndex(sp[-2], sp[-1], &sp[-2]);
+  if (error != NULL) {
+    aotError(vm, line, "%s", error);
+    return false;
+  }
+  return true;
+}
+
+bool aotSetIndex(VM* vm, Value* sp, int line) {
+  const char* error = setIndex(sp[-3], sp[-2], sp[-1]);
+  if (error != NULL) {
+    aotError(vm, line, "%s", error);
+    return false;
+  }
+  sp[-3] = sp[-1];
+  return true;
+}
+
+// ______________ Translator __________________________
+
+static void emitString(FILE* out, ObjString* string) {
+  fputc('"', out);
+  for (int i = 0; i < string->length; i++) {
+    unsigned char c = (unsigned char)string->chars[i];
+    // Octal escapes stop after three digits, unlike \x, so whatever comes next can't be swallowed.
+    if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f) {
+      fprintf(out, "\\%03o", c);
+    } else {
+      fputc(c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static void emitConstants(Chunk* chunk, FILE* out) {
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value value = chunk->constants.values[i];
+    fprintf(out, "  constants[%d] = ", i);
+    if (IS_NUMBER(value)) {
+      uint64_t bits;
+      double number = AS_NUMBER(value);
+      memcpy(&bits, &number, sizeof(double));
+      fprintf(out, "aotNumber(0x%016llxull); // %.17g\n", (unsigned long long)bits, number);
+    } else if (IS_STRING(value)) {
+      fprintf(out, "aotString(vm, ");
+      emitString(out, AS_STRING(value));
+      fprintf(out, ", %d);\n", AS_STRING(value)->length);
+    } else if (IS_BOOL(value)) {
+      fprintf(out, "BOOL_VAL(%s);\n", AS_BOOL(value) ? "true" : "false");
+    } else {
+      fprintf(out, "NIL_VAL;\n");
+    }
+  }
+}
+
+// Only jump targets get a label, so the generated code doesn't drown in unused ones.
+static bool* findTargets(Chunk* chunk) {
+  bool* targets = ALLOCATE(bool, chunk->count + 1);
+  memset(targets, 0, sizeof(bool) * (chunk->count + 1));
+
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t instruction = chunk->code[offset];
+    if (jumpWidth(instruction) > 0) {
+      int target = jumpTarget(chunk, offset);
+      if (target >= 0 && target <= chunk->count) targets[target] = true;
+    }
+
+    // An opcode we don't know ends it, emitInstruction() will give up on it anyway.
+    int length = instructionLength(instruction);
+    if (length < 0) break;
+    offset += length;
+  }
+  return targets;
+}
+
+// Writes one instruction as C and returns the offset of the next one, -1 when we don't know the opcode.
+static int emitInstruction(Chunk* chunk, int offset, FILE* out) {
+  int line = getLine(chunk, offset);
+  uint8_t* code = chunk->code;
+
+  switch (code[offset]) {
+    case OP_CONSTANT:
+      fprintf(out, "  *sp++ = constants[%d];\n", code[offset + 1]);
+      return offset + 2;
+    case OP_NIL:   fprintf(out, "  *sp++ = NIL_VAL;\n"); return offset + 1;
+    case OP_TRUE:  fprintf(out, "  *sp++ = BOOL_VAL(true);\n"); return offset + 1;
+    case OP_FALSE: fprintf(out, "  *sp++ = BOOL_VAL(false);\n"); return offset + 1;
+    case OP_POP:   fprintf(out, "  sp--;\n"); return offset + 1;
+    case OP_GET_LOCAL:
+      fprintf(out, "  *sp++ = stack[%d];\n", code[offset + 1]);
+      return offset + 2;
+    case OP_SET_LOCAL:
+      fprintf(out, "  stack[%d] = sp[-1];\n", code[offset + 1]);
+      return offset + 2;
+    case OP_GET_GLOBAL:
+      fprintf(out, "  AOT_GET_GLOBAL(constants[%d], %d);\n", code[offset + 1], line);
+      return offset + 2;
+    case OP_DEFINE_GLOBAL:
+      fprintf(out, "  materialize(vm, &sp[-1]);\n");
+      fprintf(out, "  tableSet(&vm->globals, AS_STRING(constants[%d]), sp[-1]); sp--;\n", code[offset + 1]);
+      return offset + 2;
+    case OP_SET_GLOBAL:
+      fprintf(out, "  AOT_SET_GLOBAL(constants[%d], %d);\n", code[offset + 1], line);
+      return offset + 2;
+    case OP_EQUAL:
+      fprintf(out, "  sp[-2] = BOOL_VAL(valuesEqual(sp[-2], sp[-1])); sp--;\n");
+      return offset + 1;
+    case OP_GREATER:  fprintf(out, "  AOT_BINARY(BOOL_VAL, >, %d);\n", line); return offset + 1;
+    case OP_LESS:     fprintf(out, "  AOT_BINARY(BOOL_VAL, <, %d);\n", line); return offset + 1;
+    case OP_ADD:      fprintf(out, "  AOT_ADD(%d);\n", line); return offset + 1;
+    case OP_SUBTRACT: fprintf(out, "  AOT_BINARY(NUMBER_VAL, -, %d);\n", line); return offset + 1;
+    case OP_MULTIPLY: fprintf(out, "  AOT_BINARY(NUMBER_VAL, *, %d);\n", line); return offset + 1;
+    case OP_DIVIDE:   fprintf(out, "  AOT_BINARY(NUMBER_VAL, /, %d);\n", line); return offset + 1;
+    case OP_NOT:
+      fprintf(out, "  sp[-1] = BOOL_VAL(AOT_FALSEY(sp[-1]));\n");
+      return offset + 1;
+    case OP_NEGATE: fprintf(out, "  AOT_NEGATE(%d);\n", line); return offset + 1;
+    case OP_GREATER_NUM:  fprintf(out, "  AOT_NUMBER_OP(BOOL_VAL, >);\n"); return offset + 1;
+    case OP_LESS_NUM:     fprintf(out, "  AOT_NUMBER_OP(BOOL_VAL, <);\n"); return offset + 1;
+    case OP_ADD_NUM:      fprintf(out, "  AOT_NUMBER_OP(NUMBER_VAL, +);\n"); return offset + 1;
+    case OP_SUBTRACT_NUM: fprintf(out, "  AOT_NUMBER_OP(NUMBER_VAL, -);\n"); return offset + 1;
+    case OP_MULTIPLY_NUM: fprintf(out, "  AOT_NUMBER_OP(NUMBER_VAL, *);\n"); return offset + 1;
+    case OP_DIVIDE_NUM:   fprintf(out, "  AOT_NUMBER_OP(NUMBER_VAL, /);\n"); return offset + 1;
+    case OP_NEGATE_NUM:
+      fprintf(out, "  sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));\n");
+      return offset + 1;
+    case OP_PRINT:
+      fprintf(out, "  writePrint(vm, *--sp);\n");
+      return offset + 1;
+    case OP_JUMP_SHORT:
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+      fprintf(out, "  goto L%d;\n", jumpTarget(chunk, offset));
+      return offset + instructionLength(code[offset]);
+    case OP_JUMP_IF_FALSE_SHORT:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+      fprintf(out, "  if (AOT_FALSEY(sp[-1])) goto L%d;\n", jumpTarget(chunk, offset));
+      return offset + instructionLength(code[offset]);
+    case OP_CALL:
+      fprintf(out, "  if (!aotCall(vm, sp - %d, %d, %d)) return INTERPRET_RUNTIME_ERROR;\n", code[offset + 1], code[offset + 1], line);
+      fprintf(out, "  sp -= %d;\n", code[offset + 1]);
+      return offset + 2;
+    case OP_ARRAY:
+      fprintf(out, "  sp[-%d] = aotArray(vm, sp - %d, %d);\n", code[offset + 1], code[offset + 1], code[offset + 1]);
+      fprintf(out, "  sp += %d;\n", 1 - code[offset + 1]);
+      return offset + 2;
+    case OP_GET_INDEX:
+      fprintf(out, "  if (!aotGetIndex(vm, sp, %d)) return INTERPRET_RUNTIME_ERROR;\n", line);
+      fprintf(out, "  sp--;\n");
+      return offset + 1;
+    case OP_SET_INDEX:
+      fprintf(out, "  if (!aotSetIndex(vm, sp, %d)) return INTERPRET_RUNTIME_ERROR;\n", line);
+      fprintf(out, "  sp -= 2;\n");
+      return offset + 1;
+    case OP_LOOP_SHORT:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      fprintf(out, "  vm->backEdges[%d]++;\n", code[offset + 1]);
+      fprintf(out, "  goto L%d;\n", jumpTarget(chunk, offset));
+      return offset + instructionLength(code[offset]);
+    case OP_GET_LOCAL_0:
+    case OP_GET_LOCAL_1:
+    case OP_GET_LOCAL_2:
+    case OP_GET_LOCAL_3:
+      fprintf(out, "  *sp++ = stack[%d];\n", code[offset] - OP_GET_LOCAL_0);
+      return offset + 1;
+    case OP_CONSTANT_0:
+    case OP_CONSTANT_1:
+    case OP_CONSTANT_2:
+    case OP_CONSTANT_3:
+      fprintf(out, "  *sp++ = constants[%d];\n", code[offset] - OP_CONSTANT_0);
+      return offset + 1;
+    case OP_ZERO: fprintf(out, "  *sp++ = INT_VAL(0);\n"); return offset + 1;
+    case OP_ONE:  fprintf(out, "  *sp++ = INT_VAL(1);\n"); return offset + 1;
+    case OP_SMALL_INT:
+      fprintf(out, "  *sp++ = INT_VAL(%d);\n", (int8_t)code[offset + 1]);
+      return offset + 2;
+    case OP_RETURN:
+      fprintf(out, "  return INTERPRET_OK;\n");
+      return offset + 1;
+    default:
+      return -1;
+  }
+}
+
+bool aotEmit(Chunk* chunk, FILE* out) {
+  bool* targets = findTargets(chunk);
+  // C doesn't allow an empty array.
+  int constantCount = chunk->constants.count > 0 ? chunk->constants.count : 1;
+
+  fprintf(out, "// Generated by clox --emit-c.\n");
+  fprintf(out, "#include \"aot.h\"\n\n");
+  fprintf(out, "// Runs the script in the given VM.\n");
+  fprintf(out, "InterpretResult cloxScript(VM* vm) {\n");
+  fprintf(out, "  Value constants[%d];\n", constantCount);
+  emitConstants(chunk, out);
+  fprintf(out, "\n  Value stack[STACK_MAX];\n");
+  fprintf(out, "  Value* sp = stack;\n\n");
+
+  bool ok = true;
+  int offset = 0;
+  while (offset < chunk->count) {
+    if (targets[offset]) fprintf(out, "L%d:\n", offset);
+    int next = emitInstruction(chunk, offset, out);
+    if (next < 0) {
+      fprintf(stderr, "Can't translate opcode %d at offset %d to C.\n", chunk->code[offset], offset);
+      ok = false;
+      break;
+    }
+    offset = next;
+  }
+  if (ok) {
+    if (targets[chunk->count]) fprintf(out, "L%d:\n", chunk->count);
+    fprintf(out, "  return INTERPRET_OK;\n");
+  }
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "// Runs the script in a fresh VM of its own.\n");
+  fprintf(out, "InterpretResult cloxRun() {\n");
+  fprintf(out, "  VM vm;\n");
+  fprintf(out, "  initVM(&vm);\n");
+  fprintf(out, "  InterpretResult result = cloxScript(&vm);\n");
+  fprintf(out, "  freeVM(&vm);\n");
+  fprintf(out, "  return result;\n");
+  fprintf(out, "}\n\n");
+
+  fprintf(out, "#ifndef CLOX_AOT_SHARED\n");
+  fprintf(out, "int main() {\n");
+  fprintf(out, "  return cloxRun() == INTERPRET_OK ? 0 : 70;\n");
+  fprintf(out, "}\n");
+  fprintf(out, "#endif\n");
+
+  FREE_ARRAY(bool, targets, chunk->count + 1);
+  return ok;
+}
+
+static bool endsWith(const char* string, const char* suffix) {
+  size_t length = strlen(string);
+  size_t suffixLength = strlen(suffix);
+  return length >= suffixLength && strcmp(string + length - suffixLength, suffix) == 0;
+}
+
+// Runs the compiler and waits for it. Its exit status, -1 if it couldn't be started or didn't exit.
+static int runCompiler(char** argv) {
+  pid_t pid = fork();
+  if (pid == -1) return -1;
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    fprintf(stderr, "Could not run %s.\n", argv[0]);
+    _exit(127);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1) return -1;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+bool aotCompile(Chunk* chunk, const char* output) {
+  char path[] = "/tmp/clox-aot-XXXXXX.c";
+  int fd = mkstemps(path, 2);
+  if (fd == -1) {
+    fprintf(stderr, "Could not create a temporary file for the generated C.\n");
+    return false;
+  }
+
+  FILE* file = fdopen(fd, "w");
+  bool ok = aotEmit(chunk, file);
+  fclose(file);
+  if (!ok) {
+    unlink(path);
+    return false;
+  }
+
+  // $CC can be a command with arguments of its own, like "ccache gcc", so it gets split on spaces. The paths
+  // go to the compiler as they are, without a shell in between, so nothing in them needs quoting.
+  const char* cc = getenv("CC");
+  if (cc == NULL) cc = "cc";
+  size_t ccLength = strlen(cc) + 1;
+  char* words = ALLOCATE(char, ccLength);
+  memcpy(words, cc, ccLength);
+
+  size_t rootSize = strlen(CLOX_ROOT) + 16;
+  char* include = ALLOCATE(char, rootSize);
+  sprintf(include, "-I%s/headers", CLOX_ROOT);
+  // The runtime comes from libclox.a, which is everything the interpreter is built from except main.c.
+  char* library = ALLOCATE(char, rootSize);
+  sprintf(library, "%s/libclox.a", CLOX_ROOT);
+
+  int maxArgs = (int)ccLength / 2 + 16;
+  char** argv = ALLOCATE(char*, maxArgs);
+  int argc = 0;
+  for (char* word = strtok(words, " \t"); word != NULL; word = strtok(NULL, " \t")) argv[argc++] = word;
+  if (argc == 0) argv[argc++] = "cc";
+  argv[argc++] = "-O2";
+  argv[argc++] = "-w";
+  if (endsWith(output, ".so")) {
+    argv[argc++] = "-shared";
+    argv[argc++] = "-fPIC";
+    argv[argc++] = "-DCLOX_AOT_SHARED";
+  }
+  argv[argc++] = include;
+  argv[argc++] = path;
+  argv[argc++] = library;
+  argv[argc++] = "-lm";
+  argv[argc++] = "-o";
+  argv[argc++] = (char*)output;
+  argv[argc] = NULL;
+
+  int status = runCompiler(argv);
+  FREE_ARRAY(char*, argv, maxArgs);
+  FREE_ARRAY(char, library, rootSize);
+  FREE_ARRAY(char, include, rootSize);
+  FREE_ARRAY(char, words, ccLength);
+  unlink(path);
+
+  if (status != 0) {
+    fprintf(stderr, "The C compiler failed to build %s.\n", output);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,188 @@
+#include <math.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../headers/array.h"
+#include "../headers/memory.h"
+
+ObjArray* buildArray(VM* vm, Value* values, int count) {
+  bool numbers = true;
+  for (int i = 0; i < count && numbers; i++) {
+    if (!IS_NUMBER(values[i])) numbers = false;
+  }
+
+  ObjArray* array = newArray(vm, numbers ? ARRAY_NUMBERS : ARRAY_VALUES, count);
+  for (int i = 0; i < count; i++) {
+    if (numbers) {
+      array->as.numbers[i] = AS_NUMBER(values[i]);
+    } else {
+      array->as.values[i] = values[i];
+    }
+  }
+  return array;
+}
+
+Value arrayElement(ObjArray* array, int index) {
+  return array->kind == ARRAY_NUMBERS ? NUMBER_VAL(array->as.numbers[index]) : array->as.values[index];
+}
+
+// The first thing that isn't a number turns the array into plain Values for good, it's one pass and
+// an array that got something else once tends to get it again.
+static void boxArray(ObjArray* array) {
+  Value* values = ALLOCATE(Value, array->capacity);
+  for (int i = 0; i < array->count; i++) values[i] = NUMBER_VAL(array->as.numbers[i]);
+  FREE_ARRAY(double, array->as.numbers, array->capacity);
+  array->as.values = values;
+  array->kind = ARRAY_VALUES;
+}
+
+static void storeElement(ObjArray* array, int index, Value value) {
+  if (array->kind == ARRAY_NUMBERS && !IS_NUMBER(value)) boxArray(array);
+
+  if (array->kind == ARRAY_NUMBERS) {
+    array->as.numbers[index] = AS_NUMBER(value);
+  } else {
+    array->as.values[index] = value;
+  }
+}
+
+bool unboxArray(ObjArray* array) {
+  if (array->kind == ARRAY_NUMBERS) return true;
+  for (int i = 0; i < array->count; i++) {
+    if (!IS_NUMBER(array->as.values[i])) return false;
+  }
+
+  double* numbers = ALLOCATE(double, array->capacity);
+  for (int i = 0; i < array->count; i++) numbers[i] = AS_NUMBER(array->as.values[i]);
+  FREE_ARRAY(Value, array->as.values, array->capacity);
+  array->as.numbers = numbers;
+  array->kind = ARRAY_NUMBERS;
+  return true;
+}
+
+void appendArray(ObjArray* array, Value value) {
+  if (array->capacity < array->count + 1) {
+    int oldCapacity = array->capacity;
+    array->capacity = GROW_CAPACITY(oldCapacity);
+    if (array->kind == ARRAY_NUMBERS) {
+      array->as.numbers = GROW_ARRAY(double, array->as.numbers, oldCapacity, array->capacity);
+    } else {
+      array->as.values = GROW_ARRAY(Value, array->as.values, oldCapacity, array->capacity);
+    }
+  }
+  storeElement(array, array->count++, value);
+}
+
+static const char* checkIndex(Value array, Value index, int* position) {
+  if (!IS_ARRAY(array)) return "Can only index arrays.";
+  if (!IS_NUMBER(index)) return "Array index must be a number.";
+
+  double number = AS_NUMBER(index);
+  if (number != floor(number)) return "Array index must be a whole number.";
+  if (number < 0 || number >= AS_ARRAY(array)->count) return "Array index out of bounds.";
+  *position = (int)number;
+  return NULL;
+}
+
+const char* getIndex(Value array, Value index, Value* result) {
+  int position;
+  const char* error = checkIndex(array, index, &position);
+  if (error != NULL) return error;
+
+  *result = arrayElement(AS_ARRAY(array), position);
+  return NULL;
+}
+
+const char* setIndex(Value array, Value index, Value value) {
+  int position;
+  const char* error = checkIndex(array, index, &position);
+  if (error != NULL) return error;
+
+  storeElement(AS_ARRAY(array), position, value);
+  return NULL;
+}
+
+// ______________ Bulk operations __________________________
+
+// SSE2 is part of every x86-64, so the vector paths are there on any build for it without extra flags.
+// Everything else, and whatever is left over past the last full vector, goes through the scalar loops.
+
+double sumNumbers(const double* a, int count) {
+  int i = 0;
+  double sum = 0;
+#if defined(__SSE2__)
+  // Four independent accumulators, two lanes each, so the adds don't wait on each other.
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+  for (; i + 8 <= count; i += 8) {
+    s0 = _mm_add_pd(s0, _mm_loadu_pd(a + i));
+    s1 = _mm_add_pd(s1, _mm_loadu_pd(a + i + 2));
+    s2 = _mm_add_pd(s2, _mm_loadu_pd(a + i + 4));
+    s3 = _mm_add_pd(s3, _mm_loadu_pd(a + i + 6));
+  }
+  __m128d total = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+  double lanes[2];
+  _mm_storeu_pd(lanes, total);
+  sum = lanes[0] + lanes[1];
+#endif
+  for (; i < count; i++) sum += a[i];
+  return sum;
+}
+
+double dotNumbers(const double* a, const double* b, int count) {
+  int i = 0;
+  double sum = 0;
+#if defined(__SSE2__)
+  __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+  for (; i + 8 <= count; i += 8) {
+    s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+    s2 = _mm_add_pd(s2, _mm_mul_pd(_mm_loadu_pd(a + i + 4), _mm_loadu_pd(b + i + 4)));
+    s3 = _mm_add_pd(s3, _mm_mul_pd(_mm_loadu_pd(a + i + 6), _mm_loadu_pd(b + i + 6)));
+  }
+  __m128d total = _mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3));
+  double lanes[2];
+  _mm_storeu_pd(lanes, total);
+  sum = lanes[0] + lanes[1];
+#endif
+  for (; i < count; i++) sum += a[i] * b[i];
+  return sum;
+}
+
+// The elementwise ones give exactly what a scalar loop would, every element is one operation either way.
+
+void scaleNumbers(double* a, int count, double k) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128d factor = _mm_set1_pd(k);
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_pd(a + i, _mm_mul_pd(_mm_loadu_pd(a + i), factor));
+    _mm_storeu_pd(a + i + 2, _mm_mul_pd(_mm_loadu_pd(a + i + 2), factor));
+  }
+#endif
+  for (; i < count; i++) a[i] *= k;
+}
+
+void addNumbers(double* a, const double* b, int count) {
+  int i = 0;
+#if defined(__SSE2__)
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    _mm_storeu_pd(a + i + 2, _mm_add_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+  }
+#endif
+  for (; i < count; i++) a[i] += b[i];
+}
+
+void addScalar(double* a, int count, double x) {
+  int i = 0;
+#if defined(__SSE2__)
+  __m128d addend = _mm_set1_pd(x);
+  for (; i + 4 <= count; i += 4) {
+    _mm_storeu_pd(a + i, _mm_add_pd(_mm_loadu_pd(a + i), addend));
+    _mm_storeu_pd(a + i + 2, _mm_add_pd(_mm_loadu_pd(a + i + 2), addend));
+  }
+#endif
+  for (; i < count; i++) a[i] += x;
+}
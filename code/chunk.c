@@ -6,6 +6,8 @@ void initChunk(Chunk* chunk) {
   chunk->count = 0;
   chunk->capacity = 0;
   chunk->code = NULL;
+  chunk->lineCount = 0;
+  chunk->lineCapacity = 0;
   chunk->lines = NULL;
   initValueArray(&chunk->constants);
 }
@@ -15,13 +17,275 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
     int oldCapacity = chunk->capacity;
     chunk->capacity = GROW_CAPACITY(oldCapacity);
     chunk->code = GROW_ARRAY(uint8_t, chunk->code, oldCapacity, chunk->capacity);
-
-    chunk->lines = GROW_ARRAY(int, chunk->lines, oldCapacity, chunk->capacity);
   }
 
   chunk->code[chunk->count] = byte;
-  chunk->lines[chunk->count] = line;
   chunk->count++;
+
+  // Still on the same line as the previous byte, so the current run just gets longer.
+  if (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].line == line) {
+    return;
+  }
+
+  if (chunk->lineCapacity < chunk->lineCount + 1) {
+    int oldCapacity = chunk->lineCapacity;
+    chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->lines = GROW_ARRAY(LineStart, chunk->lines, oldCapacity, chunk->lineCapacity);
+  }
+
+  LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+  lineStart->offset = chunk->count - 1;
+  lineStart->line = line;
+}
+
+// Drops every byte from count onwards, along with the line runs that only covered those bytes.
+void truncateChunk(Chunk* chunk, int count) {
+  if (count >= chunk->count) return;
+  chunk->count = count;
+
+  while (chunk->lineCount > 0 && chunk->lines[chunk->lineCount - 1].offset >= count) {
+    chunk->lineCount--;
+  }
+}
+
+// Only error reporting and the disassembler need this, so it's fine for it to be a search instead of an index.
+int getLine(Chunk* chunk, int offset) {
+  int start = 0;
+  int end = chunk->lineCount - 1;
+
+  // Binary search for the last run that starts at or before the offset.
+  while (start < end) {
+    int mid = start + (end - start + 1) / 2;
+    if (chunk->lines[mid].offset <= offset) {
+      start = mid;
+    } else {
+      end = mid - 1;
+    }
+  }
+
+  return chunk->lineCount == 0 ? 0 : chunk->lines[start].line;
+}
+
+int instructionLength(uint8_t opcode) {
+  switch (opcode) {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_CALL:
+    case OP_ARRAY:
+    case OP_SMALL_INT:
+      return 2;
+    case OP_JUMP_SHORT:
+    case OP_JUMP_IF_FALSE_SHORT:
+      return 2;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP_SHORT:
+      return 3;
+    case OP_LOOP:
+      return 4;
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+      return 5;
+    case OP_LOOP_LONG:
+      return 6;
+    default:
+      return opcode <= OP_RETURN ? 1 : -1;
+  }
+}
+
+uint8_t compactOpcode(uint8_t opcode, int operand) {
+  switch (opcode) {
+    case OP_GET_LOCAL: return operand < 4 ? OP_GET_LOCAL_0 + operand : opcode;
+    case OP_CONSTANT:  return operand < 4 ? OP_CONSTANT_0 + operand : opcode;
+    case OP_SMALL_INT:
+      if (operand == 0) return OP_ZERO;
+      if (operand == 1) return OP_ONE;
+      return opcode;
+    default:
+      return opcode;
+  }
+}
+
+uint8_t expandOpcode(uint8_t opcode, int* operand) {
+  switch (opcode) {
+    case OP_GET_LOCAL_0: case OP_GET_LOCAL_1: case OP_GET_LOCAL_2: case OP_GET_LOCAL_3:
+      *operand = opcode - OP_GET_LOCAL_0;
+      return OP_GET_LOCAL;
+    case OP_CONSTANT_0: case OP_CONSTANT_1: case OP_CONSTANT_2: case OP_CONSTANT_3:
+      *operand = opcode - OP_CONSTANT_0;
+      return OP_CONSTANT;
+    case OP_ZERO: *operand = 0; return OP_SMALL_INT;
+    case OP_ONE:  *operand = 1; return OP_SMALL_INT;
+    default:
+      return opcode;
+  }
+}
+
+// ______________ Jumps __________________________
+
+int jumpWidth(uint8_t opcode) {
+  switch (opcode) {
+    case OP_JUMP_SHORT:
+    case OP_JUMP_IF_FALSE_SHORT:
+    case OP_LOOP_SHORT:
+      return 1;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+      return 2;
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+    case OP_LOOP_LONG:
+      return 4;
+    default:
+      return 0;
+  }
+}
+
+uint8_t jumpOpcode(uint8_t opcode, int width) {
+  static const uint8_t forms[][3] = {
+    {OP_JUMP_SHORT, OP_JUMP, OP_JUMP_LONG},
+    {OP_JUMP_IF_FALSE_SHORT, OP_JUMP_IF_FALSE, OP_JUMP_IF_FALSE_LONG},
+    {OP_LOOP_SHORT, OP_LOOP, OP_LOOP_LONG},
+  };
+  int column = width == 1 ? 0 : width == 2 ? 1 : 2;
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 3; j++) {
+      if (forms[i][j] == opcode) return forms[i][column];
+    }
+  }
+  return opcode;
+}
+
+// Distances are big endian, like they've always been.
+static uint32_t readDistance(uint8_t* code, int width) {
+  uint32_t distance = 0;
+  for (int i = 0; i < width; i++) distance = (distance << 8) | code[i];
+  return distance;
+}
+
+int jumpTarget(Chunk* chunk, int offset) {
+  uint8_t opcode = chunk->code[offset];
+  int width = jumpWidth(opcode);
+  int end = offset + instructionLength(opcode);
+  uint32_t distance = readDistance(&chunk->code[end - width], width);
+  return jumpOpcode(opcode, 2) == OP_LOOP ? end - (int)distance : end + (int)distance;
+}
+
+void relaxJumps(Chunk* chunk) {
+  // Only worth doing when there are jumps, straight line code goes back untouched.
+  int count = 0;
+  int jumps = 0;
+  for (int offset = 0; offset < chunk->count; count++) {
+    int length = instructionLength(chunk->code[offset]);
+    if (length < 0) return;
+    if (jumpWidth(chunk->code[offset]) > 0) jumps++;
+    offset += length;
+  }
+  if (jumps == 0) return;
+
+  // Index the instructions, so a jump's target survives the offsets moving under it.
+
+  int* start = ALLOCATE(int, count + 1);    // old offset of each instruction
+  int* target = ALLOCATE(int, count);       // index a jump lands on, -1 for the rest
+  int* width = ALLOCATE(int, count);        // the distance width we're trying for each jump
+  int* position = ALLOCATE(int, count + 1); // new offset of each instruction
+  int oldCount = chunk->count;
+  int* indexOf = ALLOCATE(int, oldCount + 1);
+  for (int i = 0; i <= oldCount; i++) indexOf[i] = -1;
+
+  // Only safe when every jump lands on an instruction.
+  bool relax = true;
+  for (int i = 0, offset = 0; i < count; i++) {
+    start[i] = offset;
+    indexOf[offset] = i;
+    offset += instructionLength(chunk->code[offset]);
+  }
+  start[count] = chunk->count;
+  indexOf[chunk->count] = count;
+
+  for (int i = 0; i < count && relax; i++) {
+    target[i] = -1;
+    width[i] = 0;
+    if (jumpWidth(chunk->code[start[i]]) == 0) continue;
+
+    int landing = jumpTarget(chunk, start[i]);
+    if (landing < 0 || landing > chunk->count || indexOf[landing] < 0) relax = false;
+    else target[i] = indexOf[landing];
+    // Everything starts out short and only ever grows, so this can't go around forever.
+    width[i] = 1;
+  }
+
+  bool changed = relax;
+  while (changed) {
+    changed = false;
+    int offset = 0;
+    for (int i = 0; i < count; i++) {
+      position[i] = offset;
+      uint8_t opcode = chunk->code[start[i]];
+      offset += width[i] == 0 ? start[i + 1] - start[i] : instructionLength(jumpOpcode(opcode, width[i]));
+    }
+    position[count] = offset;
+
+    for (int i = 0; i < count; i++) {
+      if (width[i] == 0 || width[i] == 4) continue;
+
+      int end = position[i + 1];
+      int distance = jumpOpcode(chunk->code[start[i]], 2) == OP_LOOP ? end - position[target[i]]
+                                                                      : position[target[i]] - end;
+      if (distance > (width[i] == 1 ? UINT8_MAX : UINT16_MAX)) {
+        width[i] *= 2;
+        changed = true;
+      }
+    }
+  }
+
+  if (relax) {
+    Chunk relaxed;
+    initChunk(&relaxed);
+    int run = 0;
+    for (int i = 0; i < count; i++) {
+      while (run + 1 < chunk->lineCount && chunk->lines[run + 1].offset <= start[i]) run++;
+      int line = chunk->lineCount > 0 ? chunk->lines[run].line : 0;
+      uint8_t* code = &chunk->code[start[i]];
+
+      if (width[i] == 0) {
+        for (int j = 0; j < start[i + 1] - start[i]; j++) writeChunk(&relaxed, code[j], line);
+        continue;
+      }
+
+      uint8_t opcode = jumpOpcode(code[0], width[i]);
+      writeChunk(&relaxed, opcode, line);
+      if (jumpOpcode(opcode, 2) == OP_LOOP) writeChunk(&relaxed, code[1], line);
+      int end = position[i + 1];
+      uint32_t distance = (uint32_t)(jumpOpcode(opcode, 2) == OP_LOOP ? end - position[target[i]]
+                                                                      : position[target[i]] - end);
+      for (int shift = (width[i] - 1) * 8; shift >= 0; shift -= 8) {
+        writeChunk(&relaxed, (distance >> shift) & 0xff, line);
+      }
+    }
+
+    // Swap the new code in, the constants don't change.
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+    chunk->count = relaxed.count;
+    chunk->capacity = relaxed.capacity;
+    chunk->code = relaxed.code;
+    chunk->lineCount = relaxed.lineCount;
+    chunk->lineCapacity = relaxed.lineCapacity;
+    chunk->lines = relaxed.lines;
+    freeValueArray(&relaxed.constants);
+  }
+
+  FREE_ARRAY(int, start, count + 1);
+  FREE_ARRAY(int, target, count);
+  FREE_ARRAY(int, width, count);
+  FREE_ARRAY(int, position, count + 1);
+  FREE_ARRAY(int, indexOf, oldCount + 1);
 }
 
 int addConstant(Chunk* chunk, Value value) {
@@ -31,7 +295,7 @@ int addConstant(Chunk* chunk, Value value) {
 
 void freeChunk(Chunk* chunk) {
   FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(uint8_t, chunk->lines, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
   freeValueArray(&chunk->constants);
   initChunk(chunk);
 }
\ No newline at end of file
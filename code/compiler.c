@@ -15,18 +15,12 @@
 #include "../headers/scanner.h"
 #include "../headers/chunk.h"
 #include "../headers/object.h"
+#include "../headers/memory.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "../disassembler/debug.h"
 #endif
 
-typedef struct {
-  Token current;
-  Token previous;
-  bool hadError;
-  bool panicMode;
-} Parser;
-
 typedef enum {
   PREC_NONE,
   PREC_ASSIGNMENT,
@@ -41,8 +35,10 @@ typedef enum {
   PREC_PRIMARY
 } Precedence;
 
+typedef struct Parser Parser;
+
 // function pointer, typedef is a stylistic choice here
-typedef void (*ParseFn)(bool canAssign);
+typedef void (*ParseFn)(Parser* parser, bool canAssign);
 
 typedef struct {
   ParseFn prefix;
@@ -53,182 +49,315 @@ typedef struct {
 typedef struct {
   Token name;
   int depth;
+  StaticType type; // the type of whatever was last stored in the local along the current path
+  bool assigned;   // stored into since the innermost loop being compiled began, see loopStatement()
 } Local;
 
+// A point in the chunk we can rewind back to, so code we managed to fold or proved dead can be thrown away.
+typedef struct {
+  int code;
+  int constants;
+} CodeMark;
+
+// A point in the source we can go back to and compile again from.
+typedef struct {
+  Scanner scanner;
+  Token current;
+  Token previous;
+} SourceMark;
+
 typedef struct {
   Local locals[UINT8_COUNT];
   int localCount; // tracks how many locals are in scope (how much of the array is in use)
   int scopeDepth; // The number of blocks surrounding the current bit of code we're compiling.
+  StaticType exprType; // type of the expression we compiled last
+  CodeMark operandStart; // where the left operand of the infix operator being compiled begins
+  int temporaries; // values the enclosing expressions have left on the stack under the one being compiled
+  int loopCount; // loops emitted so far, each OP_LOOP gets the next number until they run out at SHARED_LOOP
 } Compiler;
 
-Parser parser;
-Compiler* current = NULL;
+// A loop whose type fixpoint didn't settle the first time round, and the locals that had to become unknown
+// before it did.
+typedef struct {
+  const char* start; // where the loop's source begins, the same loop starts at the same spot every time
+  bool widen[UINT8_COUNT];
+} WidenedLoop;
+
+// Everything one compilation needs. It's threaded through every function below instead of living in globals,
+// so any number of compiles can be running at once.
+struct Parser {
+  Scanner scanner;
+  Token current;
+  Token previous;
+  bool hadError;
+  bool panicMode;
+  Compiler* compiler;
+  Chunk* chunk;
+  VM* vm; // interns, and owns, the strings we create
+  WidenedLoop* widened; // every loop that has needed a second round so far
+  int widenedCount;
+  int widenedCapacity;
+};
 
 // Error handling code below
-static void errorAt(Token* token, const char* message) {
+static void errorAt(Parser* parser, Token* token, const char* message) {
   // we got a panic mode flag so our parser doesn't start throwing one error after the another
   // C doesn't have exceptions, so we just display the first error and keep on moving
   // it's like the errors never occured.
-  if (parser.panicMode) return;
-  parser.panicMode = true;
-  fprintf(stderr, "[line %d] Error", token->line);
+  if (parser->panicMode) return;
+  parser->panicMode = true;
+  fprintf(parser->vm->err, "[line %d] Error", token->line);
 
   if (token->type == TOKEN_EOF) {
-    fprintf(stderr, " at end");
+    fprintf(parser->vm->err, " at end");
   } else if (token->type == TOKEN_ERROR) {
     // Nothing.
   } else {
-    fprintf(stderr, " at '%.*s'", token->length, token->start);
+    fprintf(parser->vm->err, " at '%.*s'", token->length, token->start);
   }
 
-  fprintf(stderr, ": %s\n", message);
-  parser.hadError = true;
+  fprintf(parser->vm->err, ": %s\n", message);
+  parser->hadError = true;
 }
 
-static void error(const char* message) {
-  errorAt(&parser.previous, message);
+static void error(Parser* parser, const char* message) {
+  errorAt(parser, &parser->previous, message);
 }
 
-static void errorAtCurrent(const char* message) {
-  errorAt(&parser.current, message);
+static void errorAtCurrent(Parser* parser, const char* message) {
+  errorAt(parser, &parser->current, message);
 }
-Chunk* compilingChunk;
 
-static Chunk* currentChunk() {
-  return compilingChunk;
+static Chunk* currentChunk(Parser* parser) {
+  return parser->chunk;
 }
 
 // parsing functions below
 
-static void advance() {
+static void advance(Parser* parser) {
   // get a reference to current token before we advance
-  parser.previous = parser.current;
+  parser->previous = parser->current;
 
   for (;;) {
-    parser.current = scanToken();
+    parser->current = scanToken(&parser->scanner);
     // if valid token break loop.
-    if (parser.current.type != TOKEN_ERROR) break;
+    if (parser->current.type != TOKEN_ERROR) break;
 
-    errorAtCurrent(parser.current.start);
+    errorAtCurrent(parser, parser->current.start);
   }
 }
 
 // wrote similar function in jlox
-static void consume(TokenType type, const char* message) {
+static void consume(Parser* parser, TokenType type, const char* message) {
   // consume is like the advance() function but with type validation
-  if (parser.current.type == type) {
-    advance();
+  if (parser->current.type == type) {
+    advance(parser);
     return;
   }
 
-  errorAtCurrent(message);
+  errorAtCurrent(parser, message);
 }
 
-static bool check(TokenType type) {
-  return parser.current.type == type;
+static bool check(Parser* parser, TokenType type) {
+  return parser->current.type == type;
 }
 
-static bool match(TokenType type) {
-  if (!check(type)) return false;
-  advance();
+static bool match(Parser* parser, TokenType type) {
+  if (!check(parser, type)) return false;
+  advance(parser);
   return true;
 }
 
 // ______________ End of Parsing functions __________________________
 
 // Bytecode generation utility functions below. emitByte(), emitBytes(), emitReturn(), endCompiler()
-static void emitByte(uint8_t byte) {
-  writeChunk(currentChunk(), byte, parser.previous.line);
+static void emitByte(Parser* parser, uint8_t byte) {
+  writeChunk(currentChunk(parser), byte, parser->previous.line);
 } 
 
-static void emitBytes(uint8_t byte1, uint8_t byte2) {
-  emitByte(byte1);
-  emitByte(byte2);
+// An opcode and its operand, or just the compact opcode when there is one for that operand.
+static void emitBytes(Parser* parser, uint8_t byte1, uint8_t byte2) {
+  uint8_t compact = compactOpcode(byte1, byte2);
+  if (compact != byte1) {
+    emitByte(parser, compact);
+    return;
+  }
+  emitByte(parser, byte1);
+  emitByte(parser, byte2);
+}
+
+// Jumps always go out in their long form, nothing is too far for 32 bits. relaxJumps() shrinks them
+// once the whole chunk is there and every distance is known.
+static int emitJump(Parser* parser, uint8_t instruction) {
+  emitByte(parser, jumpOpcode(instruction, 4));
+  for (int i = 0; i < 4; i++) emitByte(parser, 0xff);
+  return currentChunk(parser)->count - 4;
+}
+
+static void emitLoop(Parser* parser, int loopStart) {
+  Compiler* current = parser->compiler;
+  emitByte(parser, OP_LOOP_LONG);
+  // A chunk can have any number of loops, there just aren't counters for all of them.
+  emitByte(parser, (uint8_t)current->loopCount);
+  if (current->loopCount < SHARED_LOOP) current->loopCount++;
+  // +4 for the offset bytes themselves, the VM has read past them by the time it jumps.
+  int offset = currentChunk(parser)->count - loopStart + 4;
+  for (int shift = 24; shift >= 0; shift -= 8) emitByte(parser, (offset >> shift) & 0xff);
 }
 
-static int emitJump(uint8_t instruction) {
-  emitByte(instruction);
-  emitByte(0xff);
-  emitByte(0xff);
-  return currentChunk()->count - 2;
+static void emitReturn(Parser* parser) {
+  emitByte(parser, OP_RETURN);
 }
 
-static void emitReturn() {
-  emitByte(OP_RETURN);
+// Constants are exact duplicates only if they have the same bits, 0 and -0 compare equal but print differently.
+static bool sameConstant(Value a, Value b) {
+  if (a.type != b.type) return false;
+  if (IS_NUMBER(a)) return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+  return valuesEqual(a, b);
 }
 
-static uint8_t makeConstant(Value value) {
-  int constant = addConstant(currentChunk(), value);
+static uint8_t makeConstant(Parser* parser, Value value) {
+  // Reuse an existing slot for the same constant, otherwise long scripts hit the 256 constant limit
+  // just from mentioning the same variable names and numbers over and over.
+  ValueArray* constants = &currentChunk(parser)->constants;
+  for (int i = 0; i < constants->count; i++) {
+    if (sameConstant(constants->values[i], value)) return (uint8_t)i;
+  }
+
+  int constant = addConstant(currentChunk(parser), value);
   
   // checks if our constant table hasn't grown over 256
   if (constant > UINT8_MAX) {
-    error("Too many constants in one chunk.");
+    error(parser, "Too many constants in one chunk.");
     return 0;
   }
 
   return (uint8_t)constant;
 }
 
-static void emitConstant(Value value) {
-  emitBytes(OP_CONSTANT, makeConstant(value));
+static void emitConstant(Parser* parser, Value value) {
+  // Small integers fit in the instruction and stay out of the constant pool.
+  if (IS_INT(value) && AS_INT(value) >= INT8_MIN && AS_INT(value) <= INT8_MAX) {
+    emitBytes(parser, OP_SMALL_INT, (uint8_t)(int8_t)AS_INT(value));
+    return;
+  }
+  emitBytes(parser, OP_CONSTANT, makeConstant(parser, value));
+}
+
+static CodeMark markCode(Parser* parser) {
+  CodeMark mark;
+  mark.code = currentChunk(parser)->count;
+  mark.constants = currentChunk(parser)->constants.count;
+  return mark;
+}
+
+static void rewindCode(Parser* parser, CodeMark mark) {
+  truncateChunk(currentChunk(parser), mark.code);
+  currentChunk(parser)->constants.count = mark.constants;
+}
+
+static SourceMark markSource(Parser* parser) {
+  return (SourceMark){parser->scanner, parser->current, parser->previous};
 }
 
-static void patchJump(int offset) {
-  // -2 to adjust for the bytecode for the jump offset itself.
-  int jump = currentChunk()->count - offset - 2;
+static void rewindSource(Parser* parser, SourceMark mark) {
+  parser->scanner = mark.scanner;
+  parser->current = mark.current;
+  parser->previous = mark.previous;
+}
 
-  if (jump > UINT16_MAX) {
-    error("Too much code to jump over.");
+// Checks whether the code in [start, end) is a single instruction pushing a constant.
+static bool constantBetween(Parser* parser, int start, int end, Value* value) {
+  Chunk* chunk = currentChunk(parser);
+  if (end <= start || instructionLength(chunk->code[start]) != end - start) return false;
+
+  int operand = end - start == 2 ? chunk->code[start + 1] : 0;
+  switch (expandOpcode(chunk->code[start], &operand)) {
+    case OP_NIL:       *value = NIL_VAL;                             return true;
+    case OP_TRUE:      *value = BOOL_VAL(true);                      return true;
+    case OP_FALSE:     *value = BOOL_VAL(false);                     return true;
+    case OP_CONSTANT:  *value = chunk->constants.values[operand];    return true;
+    case OP_SMALL_INT: *value = INT_VAL((int8_t)operand);            return true;
+    default: return false;
   }
+}
 
-  currentChunk()->code[offset] = (jump >> 8) & 0xff; // get the MSB 8 bits
-  currentChunk()->code[offset+1] = jump & 0xff; // get the LSB 8 bits
+static bool constantSince(Parser* parser, CodeMark mark, Value* value) {
+  return constantBetween(parser, mark.code, currentChunk(parser)->count, value);
+}
 
+static void emitValue(Parser* parser, Value value) {
+  if (IS_NIL(value)) {
+    emitByte(parser, OP_NIL);
+  } else if (IS_BOOL(value)) {
+    emitByte(parser, AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+  } else {
+    emitConstant(parser, value);
+  }
 }
 
-static void initCompiler(Compiler* compiler) {
+static bool isFalsey(Value value) {
+  return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+static void patchJump(Parser* parser, int offset) {
+  // -4 to adjust for the bytecode for the jump offset itself.
+  int jump = currentChunk(parser)->count - offset - 4;
+
+  // Most significant byte first.
+  for (int i = 0; i < 4; i++) {
+    currentChunk(parser)->code[offset + i] = (jump >> (24 - 8 * i)) & 0xff;
+  }
+}
+
+static void initCompiler(Parser* parser, Compiler* compiler) {
   compiler->localCount = 0;
   compiler->scopeDepth = 0;
-  current = compiler;
+  compiler->exprType = TYPE_UNKNOWN;
+  compiler->loopCount = 0;
+  compiler->temporaries = 0;
+  parser->compiler = compiler;
 }
 
-static void endCompiler() {
-  emitReturn();
+static void endCompiler(Parser* parser) {
+  emitReturn(parser);
+  if (!parser->hadError) relaxJumps(currentChunk(parser));
 
   #ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) {
-      disassembleChunk(currentChunk(), "code");
+    if (!parser->hadError) {
+      disassembleChunk(currentChunk(parser), "code");
     }
   #endif
 }
 
-static void beginScope() {
+static void beginScope(Parser* parser) {
   // all we need to do for a new scope is to increment the current depth
   // way faster approach than
-  current->scopeDepth++;
+  parser->compiler->scopeDepth++;
 }
 
-static void endScope() {
+static void endScope(Parser* parser) {
+  Compiler* current = parser->compiler;
   current->scopeDepth--;
 
   // When we pop a scope, we walk backward through the local array looking for any variables declared at the scope depth we just left.
   // We discard them by simply decrementing the length of the array.
   while (current->localCount > 0 && current->locals[current->localCount-1].depth > current->scopeDepth) {
-    emitByte(OP_POP);
+    emitByte(parser, OP_POP);
     current->localCount--;
   }
 }
 // forward declarations to handle recursive grammar
-static void expression();
+static void expression(Parser* parser);
 // blocks can contain declarations and control flow statements can contain other statements. 
-static void declaration();
-static void statement();
+static void declaration(Parser* parser);
+static void statement(Parser* parser);
 static ParseRule* getRule(TokenType type);
-static void parsePrecedence(Precedence precedence);
+static void parsePrecedence(Parser* parser, Precedence precedence);
 //_____________End of Forward Declarations__________________________
 
-static uint8_t identifierConstant(Token* name) {
-  return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
+static uint8_t identifierConstant(Parser* parser, Token* name) {
+  return makeConstant(parser, OBJ_VAL(copyString(parser->vm, name->start, name->length)));
 }
 
 static bool identifiersEqual(Token* a, Token* b) {
@@ -236,15 +365,15 @@ static bool identifiersEqual(Token* a, Token* b) {
   return memcmp(a->start, b->start, a->length) == 0;
 }
 
-static int resolveLocal(Compiler* compiler, Token* name) {
+static int resolveLocal(Parser* parser, Compiler* compiler, Token* name) {
   // We walk the array backward so we can check in previous scopes too.
   for (int i = compiler->localCount - 1; i>=0; i--) {
     Local* local = &compiler->locals[i];
     if (identifiersEqual(name, &local->name)) {
       if (local->depth == -1) {
-        error("Can't read local variable in its own initializer");
+        error(parser, "Can't read local variable in its own initializer");
       }
-      return 1;
+      return i;
     }
   }
 
@@ -253,11 +382,12 @@ static int resolveLocal(Compiler* compiler, Token* name) {
 
 }
 
-static void addLocal(Token name) {
+static void addLocal(Parser* parser, Token name) {
+  Compiler* current = parser->compiler;
   // The first error we deal with is a limitation of our VM's design. We only allow for 256 local variables in scope at a given time.
   // So we need to handle a case where we could go over that.
   if (current->localCount == UINT8_COUNT) {
-    error("Too many local variables in function.");
+    error(parser, "Too many local variables in function.");
     return;
   }
 
@@ -265,6 +395,8 @@ static void addLocal(Token name) {
   Local* local = &current->locals[current->localCount++];
   local->name = name;
   local->depth = -1;
+  local->type = TYPE_UNKNOWN;
+  local->assigned = false;
 }
   /*
     {
@@ -278,13 +410,14 @@ static void addLocal(Token name) {
 
 
 //“Declaring” is when the variable is added to the scope, and “defining” is when it becomes available for use.
-static void declareVariable() {
+static void declareVariable(Parser* parser) {
+  Compiler* current = parser->compiler;
   // This is the point where the compiler records the existence of the variable. We only do this for locals.
   // if its a global variable, we bail out since they are late bound.
   if (current->scopeDepth == 0) return;
 
   // The compiler does need to remember that these variables exist, so we keep a track of them.
-  Token* name = &parser.previous;
+  Token* name = &parser->previous;
 
   for (int i = current->localCount - 1; i>=0; i--) {
     Local* local = &current->locals[i];
@@ -296,81 +429,209 @@ static void declareVariable() {
 
     // We're walking backwards and checking here.
     if (identifiersEqual(name, &local->name)) {
-      error("Already a variable with this name in this scope");
+      error(parser, "Already a variable with this name in this scope");
     }
   }
 
-  addLocal(*name);
+  addLocal(parser, *name);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
-  consume(TOKEN_IDENTIFIER, errorMessage);
+static uint8_t parseVariable(Parser* parser, const char* errorMessage) {
+  consume(parser, TOKEN_IDENTIFIER, errorMessage);
 
-  declareVariable();
-  if (current->scopeDepth > 0) return 0;
+  declareVariable(parser);
+  if (parser->compiler->scopeDepth > 0) return 0;
 
-  return identifierConstant(&parser.previous);
+  return identifierConstant(parser, &parser->previous);
 }
 
-static void markInitialized() {
+static void markInitialized(Parser* parser) {
+  Compiler* current = parser->compiler;
   current->locals[current->localCount-1].depth = current->scopeDepth;
 }
 
-static void binary(bool canAssign) {
-  TokenType operatorType = parser.previous.type;
+// Branches can store different types into the same local, so control flow snapshots the local types
+// before a branch and merges them back together after it.
+static void saveLocalTypes(Parser* parser, StaticType* types) {
+  for (int i = 0; i < parser->compiler->localCount; i++) {
+    types[i] = parser->compiler->locals[i].type;
+  }
+}
+
+static void restoreLocalTypes(Parser* parser, StaticType* types, int count) {
+  for (int i = 0; i < count; i++) {
+    parser->compiler->locals[i].type = types[i];
+  }
+}
+
+// After two paths meet, a local only keeps its type if both paths agree on it.
+static void joinLocalTypes(Parser* parser, StaticType* other, int count) {
+  for (int i = 0; i < count; i++) {
+    if (parser->compiler->locals[i].type != other[i]) parser->compiler->locals[i].type = TYPE_UNKNOWN;
+  }
+}
+
+static bool bothNumbers(StaticType a, StaticType b) {
+  return a == TYPE_NUMBER && b == TYPE_NUMBER;
+}
+
+// Constant folding. We only fold when the result is exactly what the VM would have computed,
+// anything that would be a runtime error is left alone so the error still happens at runtime.
+static bool foldUnary(TokenType operatorType, Value operand, Value* result) {
+  switch (operatorType) {
+    case TOKEN_BANG:
+      *result = BOOL_VAL(isFalsey(operand));
+      return true;
+    case TOKEN_MINUS:
+      if (!IS_NUMBER(operand)) return false;
+      *result = negateNumber(operand);
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool foldBinary(Parser* parser, TokenType operatorType, Value a, Value b, Value* result) {
+  switch (operatorType) {
+    case TOKEN_EQUAL_EQUAL: *result = BOOL_VAL(valuesEqual(a, b));  return true;
+    case TOKEN_BANG_EQUAL:  *result = BOOL_VAL(!valuesEqual(a, b)); return true;
+    default: break;
+  }
+
+  if (operatorType == TOKEN_PLUS && IS_STRING(a) && IS_STRING(b)) {
+    ObjString* left = AS_STRING(a);
+    ObjString* right = AS_STRING(b);
+    int length = left->length + right->length;
+    char* chars = ALLOCATE(char, length + 1);
+    memcpy(chars, left->chars, left->length);
+    memcpy(chars + left->length, right->chars, right->length);
+    chars[length] = '\0';
+    *result = OBJ_VAL(takeString(parser->vm, chars, length));
+    return true;
+  }
+
+  if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+  double x = AS_NUMBER(a);
+  double y = AS_NUMBER(b);
+
+  switch (operatorType) {
+    case TOKEN_GREATER:       *result = BOOL_VAL(x > y);    return true;
+    case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+    case TOKEN_LESS:          *result = BOOL_VAL(x < y);    return true;
+    case TOKEN_LESS_EQUAL:    *result = BOOL_VAL(!(x > y)); return true;
+    case TOKEN_PLUS:          *result = addNumber(a, b);      return true;
+    case TOKEN_MINUS:         *result = subtractNumber(a, b); return true;
+    case TOKEN_STAR:          *result = multiplyNumber(a, b); return true;
+    case TOKEN_SLASH:         *result = NUMBER_VAL(x / y);  return true;
+    default: return false;
+  }
+}
+
+static void binary(Parser* parser, bool canAssign) {
+  TokenType operatorType = parser->previous.type;
+  // The left operand has already been compiled by the time we get here.
+  StaticType leftType = parser->compiler->exprType;
+  CodeMark left = parser->compiler->operandStart;
+  CodeMark right = markCode(parser);
   ParseRule* rule = getRule(operatorType);
-  parsePrecedence((Precedence)(rule->precedence + 1));
+  // The left operand waits on the stack while the right one is computed.
+  parser->compiler->temporaries++;
+  parsePrecedence(parser, (Precedence)(rule->precedence + 1));
+  parser->compiler->temporaries--;
+  StaticType rightType = parser->compiler->exprType;
+
+  // If both operands turned out to be constants, replace the whole thing with its result.
+  Value a, b, folded;
+  if (constantSince(parser, right, &b) && constantBetween(parser, left.code, right.code, &a) &&
+      foldBinary(parser, operatorType, a, b, &folded)) {
+    rewindCode(parser, left);
+    emitValue(parser, folded);
+    parser->compiler->exprType = IS_NUMBER(folded) ? TYPE_NUMBER : IS_BOOL(folded) ? TYPE_BOOL : TYPE_STRING;
+    return;
+  }
+
+  bool numbers = bothNumbers(leftType, rightType);
+  // Every operator below either produces a number or fails at runtime, except for '+' on strings
+  // and the comparisons, which always produce a bool.
+  parser->compiler->exprType = TYPE_NUMBER;
 
   switch(operatorType) {
-    case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-    case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-    case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-    case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-    case TOKEN_LESS:          emitByte(OP_LESS); break;
-    case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
-    case TOKEN_PLUS:       emitByte(OP_ADD); break;
-    case TOKEN_MINUS:      emitByte(OP_SUBTRACT); break;
-    case TOKEN_STAR:       emitByte(OP_MULTIPLY); break;
-    case TOKEN_SLASH:      emitByte(OP_DIVIDE); break;
+    case TOKEN_BANG_EQUAL:    emitBytes(parser, OP_EQUAL, OP_NOT); break;
+    case TOKEN_EQUAL_EQUAL:   emitByte(parser, OP_EQUAL); break;
+    case TOKEN_GREATER:       emitByte(parser, numbers ? OP_GREATER_NUM : OP_GREATER); break;
+    case TOKEN_GREATER_EQUAL: emitBytes(parser, numbers ? OP_LESS_NUM : OP_LESS, OP_NOT); break;
+    case TOKEN_LESS:          emitByte(parser, numbers ? OP_LESS_NUM : OP_LESS); break;
+    case TOKEN_LESS_EQUAL:    emitBytes(parser, numbers ? OP_GREATER_NUM : OP_GREATER, OP_NOT); break;
+    case TOKEN_PLUS: {
+      emitByte(parser, numbers ? OP_ADD_NUM : OP_ADD);
+      // if either side is known, OP_ADD either produces the same type or a runtime error
+      if (leftType == TYPE_STRING || rightType == TYPE_STRING) {
+        parser->compiler->exprType = TYPE_STRING;
+      } else if (leftType != TYPE_NUMBER && rightType != TYPE_NUMBER) {
+        parser->compiler->exprType = TYPE_UNKNOWN;
+      }
+      return;
+    }
+    case TOKEN_MINUS:      emitByte(parser, numbers ? OP_SUBTRACT_NUM : OP_SUBTRACT); return;
+    case TOKEN_STAR:       emitByte(parser, numbers ? OP_MULTIPLY_NUM : OP_MULTIPLY); return;
+    case TOKEN_SLASH:      emitByte(parser, numbers ? OP_DIVIDE_NUM : OP_DIVIDE); return;
     default: return;
   }
+
+  parser->compiler->exprType = TYPE_BOOL;
 }
 
-static void literal(bool canAssign) {
-  switch(parser.previous.type) {
-    case TOKEN_FALSE: emitByte(OP_FALSE); break;
-    case TOKEN_NIL:   emitByte(OP_NIL);   break;
-    case TOKEN_TRUE:  emitByte(OP_TRUE);  break;
+static void literal(Parser* parser, bool canAssign) {
+  switch(parser->previous.type) {
+    case TOKEN_FALSE: emitByte(parser, OP_FALSE); parser->compiler->exprType = TYPE_BOOL; break;
+    case TOKEN_NIL:   emitByte(parser, OP_NIL);   parser->compiler->exprType = TYPE_NIL;  break;
+    case TOKEN_TRUE:  emitByte(parser, OP_TRUE);  parser->compiler->exprType = TYPE_BOOL; break;
     default: return; // Unreachable
   }
 }
 
-static void grouping(bool canAssign) {
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+static void grouping(Parser* parser, bool canAssign) {
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
 }
 
-static void number(bool canAssign) {
-  double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
+static void number(Parser* parser, bool canAssign) {
+  // The source isn't null terminated anymore, so strtod() gets its own copy of the lexeme.
+  // Otherwise it could read past the end of a mapped file, or swallow an 'e5' that the scanner didn't.
+  char small[64];
+  int length = parser->previous.length;
+  char* lexeme = length < (int)sizeof(small) ? small : malloc(length + 1);
+  memcpy(lexeme, parser->previous.start, length);
+  lexeme[length] = '\0';
+
+  double value = strtod(lexeme, NULL);
+  if (lexeme != small) free(lexeme);
+  // Whole numbers start out as integers, so counters and indexes stay off the FPU.
+  if (value <= INT_LIMIT && value == (double)(int64_t)value) {
+    emitConstant(parser, INT_VAL((int64_t)value));
+  } else {
+    emitConstant(parser, NUMBER_VAL(value));
+  }
+  parser->compiler->exprType = TYPE_NUMBER;
 }
 
-static void string(bool canAssign) {
+static void string(Parser* parser, bool canAssign) {
   // The +1 ignores the starting quote
   // String's length without the quotes would be len - 2 
-  emitConstant(OBJ_VAL(copyString(parser.previous.start + 1,
-                                  parser.previous.length - 2)));
+  emitConstant(parser, OBJ_VAL(copyString(parser->vm, parser->previous.start + 1,
+                                  parser->previous.length - 2)));
+  parser->compiler->exprType = TYPE_STRING;
 }
 
-static void namedVariable(Token name, bool canAssign) {
+static void namedVariable(Parser* parser, Token name, bool canAssign) {
   uint8_t getOp, setOp;
-  int arg = resolveLocal(current, &name);
+  int arg = resolveLocal(parser, parser->compiler, &name);
   
   if (arg != -1) {
     getOp = OP_GET_LOCAL;
     setOp = OP_SET_LOCAL;
   } else {
-    arg = identifierConstant(&name);
+    arg = identifierConstant(parser, &name);
     getOp = OP_GET_GLOBAL;
     setOp = OP_SET_GLOBAL;
   }
@@ -379,37 +640,133 @@ static void namedVariable(Token name, bool canAssign) {
   // We look for an equals sign after the identifier
   // if we find one, instead of emitting code for a variable access, we 
   // compile the assigned value then emit an assignment instruction.
-  if (canAssign && match(TOKEN_EQUAL)) {
-    expression();
-    emitBytes(setOp, (uint8_t)arg);
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
+    expression(parser);
+    emitBytes(parser, setOp, (uint8_t)arg);
+    // Assignment evaluates to the assigned value, so exprType is already right.
+    if (setOp == OP_SET_LOCAL) {
+      parser->compiler->locals[arg].type = parser->compiler->exprType;
+      parser->compiler->locals[arg].assigned = true;
+    }
+  } else {
+    emitBytes(parser, getOp, (uint8_t)arg);
+    // Globals are late bound and can be changed by anything, so we never trust their type.
+    parser->compiler->exprType = getOp == OP_GET_LOCAL ? parser->compiler->locals[arg].type : TYPE_UNKNOWN;
+  }
+}
+
+static uint8_t argumentList(Parser* parser) {
+  uint8_t argCount = 0;
+  int pushed = 0;
+  if (!check(parser, TOKEN_RIGHT_PAREN)) {
+    do {
+      expression(parser);
+      // The count has to fit OP_CALL's operand.
+      if (argCount == 255) {
+        error(parser, "Can't have more than 255 arguments.");
+      }
+      argCount++;
+      pushed++;
+      parser->compiler->temporaries++;
+    } while (match(parser, TOKEN_COMMA));
+  }
+
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+  parser->compiler->temporaries -= pushed;
+  return argCount;
+}
+
+static void call(Parser* parser, bool canAssign) {
+  // The callee is already on the stack, the arguments go right on top of it.
+  parser->compiler->temporaries++;
+  uint8_t argCount = argumentList(parser);
+  parser->compiler->temporaries--;
+  emitBytes(parser, OP_CALL, argCount);
+  // Whatever is being called is only known at runtime, and so is what it returns.
+  parser->compiler->exprType = TYPE_UNKNOWN;
+}
+
+static void arrayLiteral(Parser* parser, bool canAssign) {
+  int count = 0;
+  if (!check(parser, TOKEN_RIGHT_BRACKET)) {
+    do {
+      expression(parser);
+      // The count has to fit OP_ARRAY's operand.
+      if (count == 255) {
+        error(parser, "Can't have more than 255 elements in an array literal.");
+      }
+      count++;
+      parser->compiler->temporaries++;
+    } while (match(parser, TOKEN_COMMA));
+  }
+
+  consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+  parser->compiler->temporaries -= count;
+  emitBytes(parser, OP_ARRAY, (uint8_t)count);
+  parser->compiler->exprType = TYPE_UNKNOWN;
+}
+
+static void subscript(Parser* parser, bool canAssign) {
+  // The array is already on the stack, the index goes on top of it.
+  parser->compiler->temporaries++;
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
+    // And the value on top of the index.
+    parser->compiler->temporaries++;
+    expression(parser);
+    parser->compiler->temporaries--;
+    // The assigned value is what the whole thing evaluates to, so exprType is already right.
+    emitByte(parser, OP_SET_INDEX);
   } else {
-    emitBytes(getOp, (uint8_t)arg);
+    emitByte(parser, OP_GET_INDEX);
+    // An array can hold anything.
+    parser->compiler->exprType = TYPE_UNKNOWN;
   }
+  parser->compiler->temporaries--;
 }
 
-static void variable(bool canAssign) {
-  namedVariable(parser.previous, canAssign);
+static void variable(Parser* parser, bool canAssign) {
+  namedVariable(parser, parser->previous, canAssign);
 }
 
-static void unary(bool canAssign) {
-  TokenType operatorType = parser.previous.type;
+static void unary(Parser* parser, bool canAssign) {
+  TokenType operatorType = parser->previous.type;
 
   // Compile the operand;
-  parsePrecedence(PREC_UNARY);
+  CodeMark operand = markCode(parser);
+  parsePrecedence(parser, PREC_UNARY);
+
+  Value value, folded;
+  if (constantSince(parser, operand, &value) && foldUnary(operatorType, value, &folded)) {
+    rewindCode(parser, operand);
+    emitValue(parser, folded);
+    parser->compiler->exprType = IS_NUMBER(folded) ? TYPE_NUMBER : TYPE_BOOL;
+    return;
+  }
 
   // Emit the operator instruction
   switch(operatorType) {
-    case TOKEN_BANG:  emitByte(OP_NOT);    break;
-    case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_BANG:
+      emitByte(parser, OP_NOT);
+      parser->compiler->exprType = TYPE_BOOL;
+      break;
+    case TOKEN_MINUS:
+      emitByte(parser, parser->compiler->exprType == TYPE_NUMBER ? OP_NEGATE_NUM : OP_NEGATE);
+      parser->compiler->exprType = TYPE_NUMBER;
+      break;
     default: return;
   }
 }
 
 ParseRule rules[] = {
-  [TOKEN_LEFT_PAREN]    = {grouping, NULL,   PREC_NONE},
+  [TOKEN_LEFT_PAREN]    = {grouping, call,   PREC_CALL},
   [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_LEFT_BRACKET]  = {arrayLiteral, subscript, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_DOT]           = {NULL,     NULL,   PREC_NONE},
   [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
@@ -448,108 +805,362 @@ ParseRule rules[] = {
   [TOKEN_EOF]           = {NULL,     NULL,   PREC_NONE},
 };
 
-static void parsePrecedence(Precedence precedence) {
-  advance();
-  ParseFn prefixRule = getRule(parser.previous.type)->prefix;
+// The VM stack doesn't grow, so every value an expression pushes needs a slot below STACK_MAX. Locals sit at
+// the bottom and the temporaries on top of them, and the value about to be compiled goes above those.
+static void checkStack(Parser* parser) {
+  Compiler* current = parser->compiler;
+  int depth = current->localCount + current->temporaries;
+  // A local whose initializer we're in doesn't have its slot yet, the initializer's value is what fills it.
+  if (current->localCount > 0 && current->locals[current->localCount - 1].depth == -1) depth--;
+  if (depth >= STACK_MAX) error(parser, "Too many values on the stack.");
+}
+
+static void parsePrecedence(Parser* parser, Precedence precedence) {
+  checkStack(parser);
+  advance(parser);
+  ParseFn prefixRule = getRule(parser->previous.type)->prefix;
   if (prefixRule == NULL) {
-    error("Expect expression.");
+    error(parser, "Expect expression.");
     return;
   }
 
   bool canAssign = precedence <= PREC_ASSIGNMENT;
-  prefixRule(canAssign);
-  while (precedence <= getRule(parser.current.type)->precedence) {
-    advance();
-    ParseFn infixRule = getRule(parser.previous.type)->infix;
-    infixRule(canAssign);
+  CodeMark start = markCode(parser);
+  prefixRule(parser, canAssign);
+  while (precedence <= getRule(parser->current.type)->precedence) {
+    advance(parser);
+    ParseFn infixRule = getRule(parser->previous.type)->infix;
+    // Everything since the start is the left operand, binary() needs to know that to fold constants.
+    parser->compiler->operandStart = start;
+    infixRule(parser, canAssign);
   }
 
-  if (canAssign && match(TOKEN_EQUAL)) {
-    error("Invalid assignment target");
+  if (canAssign && match(parser, TOKEN_EQUAL)) {
+    error(parser, "Invalid assignment target");
   }
 }
 
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(Parser* parser, uint8_t global) {
   // There is no code to create a local variable at runtime.
   // The VM has already executed the code for the variable initializer and that value is sitting on the top of the stack.
   // There's nothing to do, that temporary value on stack top becomes the local variable. Efficient af.
-  if (current->scopeDepth > 0) {
-    markInitialized();
+  if (parser->compiler->scopeDepth > 0) {
+    markInitialized(parser);
     return;
   }
 
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitBytes(parser, OP_DEFINE_GLOBAL, global);
 }
 
 static ParseRule* getRule(TokenType type) {
   return &rules[type];
 }
 
-static void expression() {
-  parsePrecedence(PREC_ASSIGNMENT);
+static void expression(Parser* parser) {
+  parsePrecedence(parser, PREC_ASSIGNMENT);
 }
 
-static void block() {
-  while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-    declaration();
+static void block(Parser* parser) {
+  while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+    declaration(parser);
   }
 
-  consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
+  consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+static void varDeclaration(Parser* parser) {
+  Compiler* current = parser->compiler;
+  uint8_t global = parseVariable(parser, "Expect variable name.");
 
-  if (match(TOKEN_EQUAL)) {
-    expression();
+  if (match(parser, TOKEN_EQUAL)) {
+    expression(parser);
   } else {
-    emitByte(OP_NIL);
+    emitByte(parser, OP_NIL);
+    current->exprType = TYPE_NIL;
   }
 
-  consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+  if (current->scopeDepth > 0) current->locals[current->localCount-1].type = current->exprType;
+  defineVariable(parser, global);
+}
 
-  defineVariable(global);
+static void expressionStatement(Parser* parser) {
+  expression(parser);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after expression.");
+  emitByte(parser, OP_POP);
 }
 
-static void expressionStatement() {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after expression.");
-  emitByte(OP_POP);
+// Compiles a statement we know can never run. We still parse and check it so errors in it get reported,
+// but the code it emitted, and anything it did to the local types, is thrown away afterwards.
+static void deadStatement(Parser* parser) {
+  CodeMark mark = markCode(parser);
+  StaticType types[UINT8_COUNT];
+  int localCount = parser->compiler->localCount;
+  int loopCount = parser->compiler->loopCount;
+  saveLocalTypes(parser, types);
+
+  statement(parser);
+
+  rewindCode(parser, mark);
+  restoreLocalTypes(parser, types, localCount);
+  parser->compiler->loopCount = loopCount;
 }
 
-static void ifStatement() {
-  consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-  expression();
-  consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+static void ifStatement(Parser* parser) {
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+  CodeMark conditionStart = markCode(parser);
+  expression(parser);
+  consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+  // When the condition folded down to a constant, only the branch that will run gets any code,
+  // and we don't need the condition, the jumps or the pops either.
+  Value condition;
+  if (constantSince(parser, conditionStart, &condition)) {
+    rewindCode(parser, conditionStart);
+    if (isFalsey(condition)) {
+      deadStatement(parser);
+      if (match(parser, TOKEN_ELSE)) statement(parser);
+    } else {
+      statement(parser);
+      if (match(parser, TOKEN_ELSE)) deadStatement(parser);
+    }
+    return;
+  }
+
+  int localCount = parser->compiler->localCount;
+  StaticType before[UINT8_COUNT];
+  StaticType thenTypes[UINT8_COUNT];
+  saveLocalTypes(parser, before);
 
-  int thenJump = emitJump(OP_JUMP_IF_FALSE);
-  emitByte(OP_POP);
-  statement();
+  int thenJump = emitJump(parser, OP_JUMP_IF_FALSE);
+  emitByte(parser, OP_POP);
+  statement(parser);
+  saveLocalTypes(parser, thenTypes);
+  restoreLocalTypes(parser, before, localCount);
 
-  int elseJump = emitJump(OP_JUMP);
+  int elseJump = emitJump(parser, OP_JUMP);
 
-  patchJump(thenJump);
-  emitByte(OP_POP);
+  patchJump(parser, thenJump);
+  emitByte(parser, OP_POP);
 
-  if (match(TOKEN_ELSE)) statement();
+  if (match(parser, TOKEN_ELSE)) statement(parser);
 
-  patchJump(elseJump);
+  patchJump(parser, elseJump);
+  joinLocalTypes(parser, thenTypes, localCount);
 }
 
-static void printStatement() {
-  expression();
-  consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-  emitByte(OP_PRINT);
+// Steps over a for loop's increment without compiling it, up to the ')' that closes the clauses.
+// An increment is an expression, so a '{' or ';' means the ')' is missing and we stop there.
+static void skipIncrement(Parser* parser) {
+  int depth = 0;
+  for (;;) {
+    TokenType type = parser->current.type;
+    if (type == TOKEN_EOF) return;
+    if (depth == 0 && (type == TOKEN_RIGHT_PAREN || type == TOKEN_LEFT_BRACE || type == TOKEN_SEMICOLON)) return;
+
+    if (type == TOKEN_LEFT_PAREN) depth++;
+    if (type == TOKEN_RIGHT_PAREN) depth--;
+    advance(parser);
+  }
 }
 
-static void synchronize() {
-  parser.panicMode = false;
+// Compiles a while loop, or a for loop from its condition on, laid out as
+//   condition, OP_JUMP_IF_FALSE to the exit, body, increment, OP_LOOP back to the condition.
+// The increment comes before the body in the source, so we skip it and come back for it once the body
+// is done. That way every trip around takes a single backward jump. backEdge gets the local types
+// the OP_LOOP carries back to the header, the locals are left with the types they have on the way out.
+static void loop(Parser* parser, bool isFor, StaticType* backEdge) {
+  Compiler* current = parser->compiler;
+  int localCount = current->localCount;
+  int loopCount = current->loopCount;
+  CodeMark loopStart = markCode(parser);
+
+  // A condition that folds to a constant either never lets the loop run or never lets it stop,
+  // and either way it doesn't need any code.
+  bool never = false;
+  int exitJump = -1;
+  if (!isFor || !match(parser, TOKEN_SEMICOLON)) {
+    expression(parser);
+    if (isFor) {
+      consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+    } else {
+      consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+    }
+
+    Value condition;
+    if (constantSince(parser, loopStart, &condition)) {
+      rewindCode(parser, loopStart);
+      never = isFalsey(condition);
+    } else {
+      exitJump = emitJump(parser, OP_JUMP_IF_FALSE);
+      emitByte(parser, OP_POP);
+    }
+  }
+  StaticType exitTypes[UINT8_COUNT];
+  saveLocalTypes(parser, exitTypes);
+
+  SourceMark increment = markSource(parser);
+  bool hasIncrement = false;
+  if (isFor) {
+    hasIncrement = !check(parser, TOKEN_RIGHT_PAREN);
+    skipIncrement(parser);
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+  }
 
-  while (parser.current.type != TOKEN_EOF) {
-    if (parser.previous.type == TOKEN_SEMICOLON) return;
+  statement(parser);
+
+  if (hasIncrement) {
+    SourceMark afterBody = markSource(parser);
+    rewindSource(parser, increment);
+    expression(parser);
+    // skipIncrement() only looked for the ')', this is where we find out the increment ends there.
+    if (!check(parser, TOKEN_RIGHT_PAREN)) errorAtCurrent(parser, "Expect ')' after for clauses.");
+    emitByte(parser, OP_POP);
+    rewindSource(parser, afterBody);
+  }
+
+  if (never) {
+    // The body was only compiled to check it, it can't run, so nothing comes back around either.
+    rewindCode(parser, loopStart);
+    current->loopCount = loopCount;
+    restoreLocalTypes(parser, exitTypes, localCount);
+    saveLocalTypes(parser, backEdge);
+    return;
+  }
 
-    switch(parser.current.type) {
+  saveLocalTypes(parser, backEdge);
+  emitLoop(parser, loopStart.code);
+  if (exitJump != -1) {
+    patchJump(parser, exitJump);
+    emitByte(parser, OP_POP);
+  }
+  restoreLocalTypes(parser, exitTypes, localCount);
+}
+
+// These hand out indexes, a nested loop can add one and move the array while we hold on to ours.
+static int findWidened(Parser* parser, const char* start) {
+  for (int i = 0; i < parser->widenedCount; i++) {
+    if (parser->widened[i].start == start) return i;
+  }
+  return -1;
+}
+
+static int addWidened(Parser* parser, const char* start) {
+  if (parser->widenedCapacity < parser->widenedCount + 1) {
+    int oldCapacity = parser->widenedCapacity;
+    parser->widenedCapacity = GROW_CAPACITY(oldCapacity);
+    parser->widened = GROW_ARRAY(WidenedLoop, parser->widened, oldCapacity, parser->widenedCapacity);
+  }
+  WidenedLoop* loop = &parser->widened[parser->widenedCount];
+  loop->start = start;
+  for (int i = 0; i < UINT8_COUNT; i++) loop->widen[i] = false;
+  return parser->widenedCount++;
+}
+
+static void widenLocals(Parser* parser, bool* widen, int count) {
+  for (int i = 0; i < count; i++) {
+    if (widen[i]) parser->compiler->locals[i].type = TYPE_UNKNOWN;
+  }
+}
+
+// The header of a loop is reached both from before the loop and from the bottom of the body, and the body
+// can leave a different type in a local than the one it had coming in. So we compile the loop assuming the
+// types from before it, and if the back edge disagrees, the locals it disagrees on become unknown and the
+// whole loop gets compiled again. If that still doesn't settle it, every local the body stores into becomes
+// unknown, and nothing the body does can disagree with that, so a loop takes three rounds at most.
+//
+// Recompiling a loop recompiles the loops inside it too, and if those went round several times every time,
+// nesting would multiply the work at each level. So a loop that needed more than one round remembers the
+// locals it had to widen and starts out with them widened whenever it gets compiled again.
+static void loopStatement(Parser* parser, bool isFor) {
+  Compiler* current = parser->compiler;
+  int localCount = current->localCount;
+  int loopCount = current->loopCount;
+  SourceMark source = markSource(parser);
+  CodeMark code = markCode(parser);
+  StaticType entry[UINT8_COUNT];
+  StaticType header[UINT8_COUNT];
+  StaticType backEdge[UINT8_COUNT];
+  saveLocalTypes(parser, entry);
+
+  // The flags only track this loop's body while it compiles, the enclosing loops get them back after.
+  bool outerAssigned[UINT8_COUNT];
+  for (int i = 0; i < localCount; i++) {
+    outerAssigned[i] = current->locals[i].assigned;
+    current->locals[i].assigned = false;
+  }
+
+  int widened = findWidened(parser, source.current.start);
+  if (widened != -1) widenLocals(parser, parser->widened[widened].widen, localCount);
+
+  for (int round = 1;; round++) {
+    saveLocalTypes(parser, header);
+    loop(parser, isFor, backEdge);
+
+    bool settled = true;
+    for (int i = 0; i < localCount; i++) {
+      if (header[i] != TYPE_UNKNOWN && backEdge[i] != header[i]) settled = false;
+    }
+    // Code with errors in it never runs, and going around again would report them twice.
+    if (settled || parser->hadError) break;
+
+    rewindSource(parser, source);
+    rewindCode(parser, code);
+    current->loopCount = loopCount;
+    restoreLocalTypes(parser, header, localCount);
+    if (round == 1 && widened == -1) {
+      joinLocalTypes(parser, backEdge, localCount);
+    } else {
+      bool assigned[UINT8_COUNT];
+      for (int i = 0; i < localCount; i++) assigned[i] = current->locals[i].assigned;
+      widenLocals(parser, assigned, localCount);
+    }
+
+    if (widened == -1) widened = addWidened(parser, source.current.start);
+    for (int i = 0; i < localCount; i++) {
+      if (entry[i] != TYPE_UNKNOWN && current->locals[i].type == TYPE_UNKNOWN) parser->widened[widened].widen[i] = true;
+    }
+  }
+
+  for (int i = 0; i < localCount; i++) current->locals[i].assigned |= outerAssigned[i];
+}
+
+static void whileStatement(Parser* parser) {
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+  loopStatement(parser, false);
+}
+
+static void forStatement(Parser* parser) {
+  // A variable declared in the initializer is scoped to the loop.
+  beginScope(parser);
+  consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+  if (match(parser, TOKEN_SEMICOLON)) {
+    // No initializer.
+  } else if (match(parser, TOKEN_VAR)) {
+    varDeclaration(parser);
+  } else {
+    expressionStatement(parser);
+  }
+
+  loopStatement(parser, true);
+  endScope(parser);
+}
+
+static void printStatement(Parser* parser) {
+  expression(parser);
+  consume(parser, TOKEN_SEMICOLON, "Expect ';' after value.");
+  emitByte(parser, OP_PRINT);
+}
+
+static void synchronize(Parser* parser) {
+  parser->panicMode = false;
+
+  while (parser->current.type != TOKEN_EOF) {
+    if (parser->previous.type == TOKEN_SEMICOLON) return;
+
+    switch(parser->current.type) {
       case TOKEN_CLASS:
       case TOKEN_FUN:
       case TOKEN_VAR:
@@ -564,7 +1175,7 @@ static void synchronize() {
        ; // do nothing.
     }
 
-    advance();
+    advance(parser);
   }
 
   // we skip tokens indiscriminantly until we reach something that looks like a statement boundary. 
@@ -572,17 +1183,17 @@ static void synchronize() {
   // we look for a statement token that begins a statement, usually one of the control flow statements or a declaration of keywords.
 }
 
-static void declaration() {
-  if (match(TOKEN_VAR)) {
-    varDeclaration();
+static void declaration(Parser* parser) {
+  if (match(parser, TOKEN_VAR)) {
+    varDeclaration(parser);
   } else {
-    statement();
+    statement(parser);
   }
 
-  if (parser.panicMode) synchronize();
+  if (parser->panicMode) synchronize(parser);
 }
 
-static void statement() {
+static void statement(Parser* parser) {
   /*
   statement -> exprStmt
            | forStmt
@@ -595,36 +1206,48 @@ static void statement() {
   block     -> "{" declaration* "}"
 
   */
-  if (match(TOKEN_PRINT)) {
-    printStatement();
-  }else if (match(TOKEN_IF)) {
-    ifStatement();
-  }
-  else if (match(TOKEN_LEFT_BRACE)) {
-    beginScope();
-    block();
-    endScope();
+  if (match(parser, TOKEN_PRINT)) {
+    printStatement(parser);
+  }else if (match(parser, TOKEN_IF)) {
+    ifStatement(parser);
+  } else if (match(parser, TOKEN_WHILE)) {
+    whileStatement(parser);
+  } else if (match(parser, TOKEN_FOR)) {
+    forStatement(parser);
+  }
+  else if (match(parser, TOKEN_LEFT_BRACE)) {
+    beginScope(parser);
+    block(parser);
+    endScope(parser);
   } 
   else {
-    expressionStatement();
+    expressionStatement(parser);
   }
 }
 
 // Main compilation logic
 
-bool compile(const char* source, Chunk* chunk) {
+bool compile(VM* vm, const char* source, size_t length, Chunk* chunk) {
+  Parser context;
+  Parser* parser = &context;
   Compiler compiler;
-  initScanner(source);
-  compilingChunk = chunk;
-  parser.hadError = false;
-  parser.panicMode = false;
-
-  advance();
-
-  while(!match(TOKEN_EOF)) {
-    declaration();
+  initScanner(&parser->scanner, source, length);
+  initCompiler(parser, &compiler);
+  parser->chunk = chunk;
+  parser->vm = vm;
+  parser->hadError = false;
+  parser->panicMode = false;
+  parser->widened = NULL;
+  parser->widenedCount = 0;
+  parser->widenedCapacity = 0;
+
+  advance(parser);
+
+  while(!match(parser, TOKEN_EOF)) {
+    declaration(parser);
   }
 
-  endCompiler();
-  return !parser.hadError;
+  endCompiler(parser);
+  FREE_ARRAY(WidenedLoop, parser->widened, parser->widenedCapacity);
+  return !parser->hadError;
 }
\ No newline at end of file
@@ -0,0 +1,78 @@
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/intern.h"
+#include "../headers/memory.h"
+
+// Past this we stop taking new strings, so probe sequences stay short and always end in an empty slot.
+#define SHARED_MAX_LOAD 0.75
+
+typedef struct {
+  _Atomic(ObjString*)* slots;
+  int capacity; // always a power of two, so the probe can mask instead of taking a remainder
+  atomic_int count;
+} SharedStrings;
+
+static SharedStrings shared;
+
+void initSharedStrings(int capacity) {
+  int size = 8;
+  while (size < capacity) size *= 2;
+
+  shared.slots = ALLOCATE(_Atomic(ObjString*), size);
+  for (int i = 0; i < size; i++) atomic_init(&shared.slots[i], NULL);
+  shared.capacity = size;
+  atomic_init(&shared.count, 0);
+}
+
+void freeSharedStrings() {
+  for (int i = 0; i < shared.capacity; i++) {
+    ObjString* string = atomic_load_explicit(&shared.slots[i], memory_order_relaxed);
+    if (string == NULL) continue;
+    FREE_ARRAY(char, string->chars, string->length + 1);
+    FREE(ObjString, string);
+  }
+  FREE_ARRAY(_Atomic(ObjString*), shared.slots, shared.capacity);
+  shared.slots = NULL;
+  shared.capacity = 0;
+}
+
+bool sharedStringsReady() {
+  return shared.slots != NULL;
+}
+
+static bool sameString(ObjString* string, const char* chars, int length, uint32_t hash) {
+  return string->hash == hash && string->length == length && memcmp(string->chars, chars, length) == 0;
+}
+
+ObjString* findSharedString(const char* chars, int length, uint32_t hash) {
+  uint32_t mask = (uint32_t)shared.capacity - 1;
+  for (uint32_t index = hash & mask;; index = (index + 1) & mask) {
+    // Acquire pairs with the release in the insert, so a string we can see is fully written.
+    ObjString* string = atomic_load_explicit(&shared.slots[index], memory_order_acquire);
+    if (string == NULL) return NULL;
+    if (sameString(string, chars, length, hash)) return string;
+  }
+}
+
+ObjString* internSharedString(ObjString* string) {
+  uint32_t mask = (uint32_t)shared.capacity - 1;
+  for (uint32_t index = string->hash & mask;; index = (index + 1) & mask) {
+    ObjString* existing = atomic_load_explicit(&shared.slots[index], memory_order_acquire);
+
+    if (existing == NULL) {
+      if (atomic_load_explicit(&shared.count, memory_order_relaxed) >= shared.capacity * SHARED_MAX_LOAD) {
+        return NULL;
+      }
+      if (atomic_compare_exchange_strong_explicit(&shared.slots[index], &existing, string,
+                                                  memory_order_release, memory_order_acquire)) {
+        atomic_fetch_add_explicit(&shared.count, 1, memory_order_relaxed);
+        return string;
+      }
+      // Somebody beat us to this slot, and existing now holds what they put there. It might be our string.
+    }
+
+    if (sameString(existing, string->chars, string->length, string->hash)) return existing;
+  }
+}
@@ -0,0 +1,621 @@
+/*
+  A baseline template JIT for Linux x86-64 (--jit).
+
+  Every opcode has a fixed template of machine code, and we stamp them out one after another
+  in bytecode order, so there's no dispatch loop left at runtime. The VM stack stays exactly where it is,
+  rbx holds the address of the VM's stackTop for the whole function and templates work on it directly.
+
+  The number paths are inlined. Whenever a template's guard fails, like a generic OP_ADD that turns out
+  not to be adding two numbers, the native code returns the offset of that instruction and the interpreter
+  takes over from there. It redoes the instruction, so it raises the runtime error or takes the slow path
+  itself. Opcodes that need the runtime (globals, printing, strings) call small C helpers.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/array.h"
+#include "../headers/jit.h"
+#include "../headers/memory.h"
+#include "../headers/object.h"
+#include "../headers/table.h"
+#include "../headers/vm.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+// The templates bake in the layout of a Value.
+_Static_assert(sizeof(Value) == 16, "templates assume a 16 byte Value");
+_Static_assert(offsetof(Value, as) == 8, "templates assume the payload sits 8 bytes in");
+
+// Displacements from the stack top, the value on top of the stack is at -16 and the one under it at -32.
+#define TOP_TYPE    -16
+#define TOP_AS      -8
+#define SECOND_TYPE -32
+#define SECOND_AS   -24
+
+// Helpers return one of these. Anything but HELPER_OK sends us back into the interpreter.
+#define HELPER_OK     0
+#define HELPER_DEOPT  1
+
+typedef struct {
+  int at;     // where the rel32 sits in the buffer
+  int offset; // the bytecode offset it has to reach
+} Patch;
+
+typedef struct {
+  VM* vm; // the code is only good for this VM, its stack and globals are baked in
+  Chunk* chunk;
+  uint8_t* buffer;
+  int count;
+  int capacity;
+
+  int* labels; // bytecode offset -> native offset, -1 if the instruction wasn't compiled
+
+  Patch* jumps; // jumps to other instructions
+  int jumpCount;
+  int jumpCapacity;
+
+  Patch* exits; // guard failures that resume the interpreter at an offset
+  int exitCount;
+  int exitCapacity;
+
+  Patch* returns; // jumps to the epilogue
+  int returnCount;
+  int returnCapacity;
+} Assembler;
+
+// ______________ Runtime helpers called from the templates __________________________
+
+static int helperGetGlobal(VM* vm, int constant) {
+  ObjString* name = AS_STRING(vm->chunk->constants.values[constant]);
+  Value value;
+  // An undefined variable is a runtime error, the interpreter reports it.
+  if (!tableGet(&vm->globals, name, &value)) return HELPER_DEOPT;
+  push(vm, value);
+  return HELPER_OK;
+}
+
+static int helperDefineGlobal(VM* vm, int constant) {
+  ObjString* name = AS_STRING(vm->chunk->constants.values[constant]);
+  materialize(vm, &vm->stackTop[-1]);
+  tableSet(&vm->globals, name, vm->stackTop[-1]);
+  pop(vm);
+  return HELPER_OK;
+}
+
+static int helperSetGlobal(VM* vm, int constant) {
+  ObjString* name = AS_STRING(vm->chunk->constants.values[constant]);
+  materialize(vm, &vm->stackTop[-1]);
+  if (tableSet(&vm->globals, name, vm->stackTop[-1])) {
+    // Undo the accidental definition and let the interpreter raise the error.
+    tableDelete(&vm->globals, name);
+    return HELPER_DEOPT;
+  }
+  return HELPER_OK;
+}
+
+static int helperEqual(VM* vm, int unused) {
+  Value b = pop(vm);
+  Value a = pop(vm);
+  push(vm, BOOL_VAL(valuesEqual(a, b)));
+  return HELPER_OK;
+}
+
+static int helperNot(VM* vm, int unused) {
+  Value value = pop(vm);
+  push(vm, BOOL_VAL(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value))));
+  return HELPER_OK;
+}
+
+// Only reached once the inline number check on OP_ADD has failed.
+static int helperAdd(VM* vm, int unused) {
+  if (!isText(vm->stackTop[-1]) || !isText(vm->stackTop[-2])) return HELPER_DEOPT;
+  concatenate(vm);
+  return HELPER_OK;
+}
+
+static int helperPrint(VM* vm, int unused) {
+  writePrint(vm, pop(vm));
+  return HELPER_OK;
+}
+
+// Anything the interpreter would report as an error it gets to redo, natives don't have side effects
+// that running them twice could show, clock() aside.
+static int helperCall(VM* vm, int argCount) {
+  Value callee = vm->stackTop[-1 - argCount];
+  if (!IS_NATIVE(callee)) return HELPER_DEOPT;
+  ObjNative* native = AS_NATIVE(callee);
+  if (native->arity >= 0 && argCount != native->arity) return HELPER_DEOPT;
+
+  Value* args = vm->stackTop - argCount;
+  if (native->function(vm, argCount, args) != NULL) return HELPER_DEOPT;
+  vm->stackTop = args;
+  return HELPER_OK;
+}
+
+static int helperArray(VM* vm, int count) {
+  ObjArray* array = buildArray(vm, vm->stackTop - count, count);
+  vm->stackTop -= count;
+  push(vm, OBJ_VAL(array));
+  return HELPER_OK;
+}
+
+static int helperGetIndex(VM* vm, int unused) {
+  if (getIndex(vm->stackTop[-2], vm->stackTop[-1], &vm->stackTop[-2]) != NULL) return HELPER_DEOPT;
+  vm->stackTop--;
+  return HELPER_OK;
+}
+
+// A failed store doesn't change anything, so the interpreter can redo it.
+static int helperSetIndex(VM* vm, int unused) {
+  if (setIndex(vm->stackTop[-3], vm->stackTop[-2], vm->stackTop[-1]) != NULL) return HELPER_DEOPT;
+  vm->stackTop[-3] = vm->stackTop[-1];
+  vm->stackTop -= 2;
+  return HELPER_OK;
+}
+
+// ______________ Assembler __________________________
+
+static void reserve(Assembler* as, int count) {
+  if (as->capacity < as->count + count) {
+    int oldCapacity = as->capacity;
+    as->capacity = GROW_CAPACITY(oldCapacity);
+    while (as->capacity < as->count + count) as->capacity *= 2;
+    as->buffer = GROW_ARRAY(uint8_t, as->buffer, oldCapacity, as->capacity);
+  }
+}
+
+static void emit(Assembler* as, uint8_t byte) {
+  reserve(as, 1);
+  as->buffer[as->count++] = byte;
+}
+
+static void emitBytes(Assembler* as, const uint8_t* bytes, int count) {
+  reserve(as, count);
+  memcpy(as->buffer + as->count, bytes, count);
+  as->count += count;
+}
+
+// x86 is little endian, so the host's own byte order is the encoding.
+static void emit32(Assembler* as, uint32_t value) {
+  emitBytes(as, (const uint8_t*)&value, 4);
+}
+
+static void emit64(Assembler* as, uint64_t value) {
+  emitBytes(as, (const uint8_t*)&value, 8);
+}
+
+static void patch32(Assembler* as, int at, int32_t value) {
+  memcpy(as->buffer + at, &value, 4);
+}
+
+static void addPatch(Patch** patches, int* count, int* capacity, int at, int offset) {
+  if (*capacity < *count + 1) {
+    int oldCapacity = *capacity;
+    *capacity = GROW_CAPACITY(oldCapacity);
+    *patches = GROW_ARRAY(Patch, *patches, oldCapacity, *capacity);
+  }
+  (*patches)[*count].at = at;
+  (*patches)[*count].offset = offset;
+  (*count)++;
+}
+
+// Emits the opcode bytes of a rel32 branch and remembers to point it at a bytecode offset.
+static void jumpTo(Assembler* as, const uint8_t* opcode, int length, int offset) {
+  emitBytes(as, opcode, length);
+  addPatch(&as->jumps, &as->jumpCount, &as->jumpCapacity, as->count, offset);
+  emit32(as, 0);
+}
+
+// A branch that leaves native code and resumes the interpreter at the given instruction.
+static void exitTo(Assembler* as, const uint8_t* opcode, int length, int offset) {
+  emitBytes(as, opcode, length);
+  addPatch(&as->exits, &as->exitCount, &as->exitCapacity, as->count, offset);
+  emit32(as, 0);
+}
+
+static const uint8_t JMP[] = {0xe9};
+static const uint8_t JE[] = {0x0f, 0x84};
+static const uint8_t JNE[] = {0x0f, 0x85};
+
+// eax = result; jmp epilogue
+static void emitReturn(Assembler* as, int result) {
+  emit(as, 0xb8); emit32(as, (uint32_t)result);
+  emit(as, 0xe9);
+  addPatch(&as->returns, &as->returnCount, &as->returnCapacity, as->count, 0);
+  emit32(as, 0);
+}
+
+// mov rax, [rbx]
+static void loadTop(Assembler* as) {
+  static const uint8_t code[] = {0x48, 0x8b, 0x03};
+  emitBytes(as, code, sizeof(code));
+}
+
+// mov [rbx], rax
+static void storeTop(Assembler* as) {
+  static const uint8_t code[] = {0x48, 0x89, 0x03};
+  emitBytes(as, code, sizeof(code));
+}
+
+// rcx = address
+static void loadAddress(Assembler* as, void* address) {
+  emit(as, 0x48); emit(as, 0xb9); emit64(as, (uint64_t)(uintptr_t)address);
+}
+
+// Pushes the 16 byte Value that rcx points at.
+static void pushFromRcx(Assembler* as) {
+  static const uint8_t code[] = {
+    0x48, 0x8b, 0x03,             // mov rax, [rbx]
+    0xf3, 0x0f, 0x6f, 0x01,       // movdqu xmm0, [rcx]
+    0xf3, 0x0f, 0x7f, 0x00,       // movdqu [rax], xmm0
+    0x48, 0x83, 0xc0, 0x10,       // add rax, 16
+    0x48, 0x89, 0x03,             // mov [rbx], rax
+  };
+  emitBytes(as, code, sizeof(code));
+}
+
+// Pushes a Value with the given type and a payload of 0 or 1.
+static void pushLiteral(Assembler* as, ValueType type, int payload) {
+  loadTop(as);
+  emit(as, 0xc7); emit(as, 0x00); emit32(as, type);                 // mov dword [rax], type
+  emit(as, 0x48); emit(as, 0xc7); emit(as, 0x40); emit(as, 0x08);   // mov qword [rax+8], payload
+  emit32(as, (uint32_t)payload);
+  emit(as, 0x48); emit(as, 0x83); emit(as, 0xc0); emit(as, 0x10);   // add rax, 16
+  storeTop(as);
+}
+
+// Pushes a double that's baked into the code.
+static void pushDouble(Assembler* as, double number) {
+  uint64_t bits;
+  memcpy(&bits, &number, sizeof(bits));
+  loadTop(as);
+  emit(as, 0xc7); emit(as, 0x00); emit32(as, VAL_NUMBER);          // mov dword [rax], VAL_NUMBER
+  emit(as, 0x48); emit(as, 0xb9); emit64(as, bits);                 // mov rcx, bits
+  emit(as, 0x48); emit(as, 0x89); emit(as, 0x48); emit(as, 0x08);   // mov [rax+8], rcx
+  emit(as, 0x48); emit(as, 0x83); emit(as, 0xc0); emit(as, 0x10);   // add rax, 16
+  storeTop(as);
+}
+
+// Integer constants go in as doubles, so the conversions in front of the arithmetic find nothing to do.
+static void pushConstant(Assembler* as, Value* constant) {
+  if (IS_INT(*constant)) {
+    pushDouble(as, AS_NUMBER(*constant));
+  } else {
+    loadAddress(as, constant);
+    pushFromRcx(as);
+  }
+}
+
+// The templates only do doubles. An integer at disp from the stack top gets converted in place, it's the
+// same number either way, and everything computed from it comes out a double. Expects rax = stack top.
+static void intToDouble(Assembler* as, int8_t disp) {
+  // One emitBytes, this goes in front of every number operand so it adds up on a long straight line script.
+  uint8_t code[] = {
+    0x83, 0x78, (uint8_t)disp, VAL_INT,                           // cmp dword [rax+disp], VAL_INT
+    0x75, 18,                                                     // jne past the conversion
+    0xf2, 0x48, 0x0f, 0x2a, 0x40, (uint8_t)(disp + 8),            // cvtsi2sd xmm0, [rax+disp+8]
+    0xf2, 0x0f, 0x11, 0x40, (uint8_t)(disp + 8),                  // movsd [rax+disp+8], xmm0
+    0xc7, 0x40, (uint8_t)disp, VAL_NUMBER, 0x00, 0x00, 0x00,      // mov dword [rax+disp], VAL_NUMBER
+  };
+  emitBytes(as, code, sizeof(code));
+}
+
+// Both operands of a _NUM operator, which are numbers but not necessarily doubles.
+static void intsToDoubles(Assembler* as) {
+  intToDouble(as, SECOND_TYPE);
+  intToDouble(as, TOP_TYPE);
+}
+
+// Leaves native code unless the Value at disp from the stack top is a number.
+static void guardNumber(Assembler* as, int8_t disp, int offset) {
+  intToDouble(as, disp);
+  emit(as, 0x83); emit(as, 0x78); emit(as, (uint8_t)disp); emit(as, VAL_NUMBER); // cmp dword [rax+disp], VAL_NUMBER
+  exitTo(as, JNE, sizeof(JNE), offset);
+}
+
+// Both operands of a binary operator have to be numbers.
+static void guardNumbers(Assembler* as, int offset) {
+  loadTop(as);
+  guardNumber(as, SECOND_TYPE, offset);
+  guardNumber(as, TOP_TYPE, offset);
+}
+
+// a = a op b on the two numbers on top of the stack, then pop b. Expects rax = stack top.
+static void numberArithmetic(Assembler* as, uint8_t sseOp) {
+  emit(as, 0xf2); emit(as, 0x0f); emit(as, 0x10); emit(as, 0x40); emit(as, (uint8_t)SECOND_AS);  // movsd xmm0, [rax-24]
+  emit(as, 0xf2); emit(as, 0x0f); emit(as, sseOp); emit(as, 0x40); emit(as, (uint8_t)TOP_AS);    // <op>sd xmm0, [rax-8]
+  emit(as, 0xf2); emit(as, 0x0f); emit(as, 0x11); emit(as, 0x40); emit(as, (uint8_t)SECOND_AS);  // movsd [rax-24], xmm0
+  emit(as, 0x48); emit(as, 0x83); emit(as, 0xe8); emit(as, 0x10);                                 // sub rax, 16
+  storeTop(as);
+}
+
+// Compares the two numbers on top of the stack and replaces them with a bool. Expects rax = stack top.
+static void numberComparison(Assembler* as, bool greater) {
+  // a > b is "above" for ucomisd a, b and a < b is "above" for ucomisd b, a. NaNs come out unordered, so false.
+  int8_t left = greater ? SECOND_AS : TOP_AS;
+  int8_t right = greater ? TOP_AS : SECOND_AS;
+  emit(as, 0xf2); emit(as, 0x0f); emit(as, 0x10); emit(as, 0x40); emit(as, (uint8_t)left);  // movsd xmm0, [rax+left]
+  emit(as, 0x66); emit(as, 0x0f); emit(as, 0x2e); emit(as, 0x40); emit(as, (uint8_t)right); // ucomisd xmm0, [rax+right]
+  emit(as, 0x0f); emit(as, 0x97); emit(as, 0xc1);                                           // seta cl
+  emit(as, 0x0f); emit(as, 0xb6); emit(as, 0xc9);                                           // movzx ecx, cl
+  emit(as, 0xc7); emit(as, 0x40); emit(as, (uint8_t)SECOND_TYPE); emit32(as, VAL_BOOL);     // mov dword [rax-32], VAL_BOOL
+  emit(as, 0x48); emit(as, 0x89); emit(as, 0x48); emit(as, (uint8_t)SECOND_AS);             // mov [rax-24], rcx
+  emit(as, 0x48); emit(as, 0x83); emit(as, 0xe8); emit(as, 0x10);                           // sub rax, 16
+  storeTop(as);
+}
+
+// Flips the sign bit of the number on top of the stack. Expects rax = stack top.
+static void numberNegate(Assembler* as) {
+  emit(as, 0x48); emit(as, 0xb9); emit64(as, 0x8000000000000000ull); // mov rcx, sign bit
+  emit(as, 0x48); emit(as, 0x31); emit(as, 0x48); emit(as, (uint8_t)TOP_AS); // xor [rax-8], rcx
+}
+
+// Calls helper(vm, operand) and leaves native code if it asks for the interpreter.
+static void callHelper(Assembler* as, int (*helper)(VM*, int), int operand, int offset) {
+  emit(as, 0x48); emit(as, 0xbf); emit64(as, (uint64_t)(uintptr_t)as->vm); // mov rdi, vm
+  emit(as, 0xbe); emit32(as, (uint32_t)operand);                         // mov esi, operand
+  emit(as, 0x48); emit(as, 0xb8); emit64(as, (uint64_t)(uintptr_t)helper); // mov rax, helper
+  emit(as, 0xff); emit(as, 0xd0);                                        // call rax
+  emit(as, 0x85); emit(as, 0xc0);                                        // test eax, eax
+  exitTo(as, JNE, sizeof(JNE), offset);
+}
+
+// Jumps to the target when the value on top of the stack is falsey, nil or false. It stays on the stack.
+static void jumpIfFalsey(Assembler* as, int target) {
+  loadTop(as);
+  emit(as, 0x8b); emit(as, 0x48); emit(as, (uint8_t)TOP_TYPE);  // mov ecx, [rax-16]
+  emit(as, 0x83); emit(as, 0xf9); emit(as, VAL_NIL);             // cmp ecx, VAL_NIL
+  jumpTo(as, JE, sizeof(JE), target);
+  emit(as, 0x83); emit(as, 0xf9); emit(as, VAL_BOOL);            // cmp ecx, VAL_BOOL
+  emit(as, 0x75); emit(as, 0x0a);                                // jne past the next two instructions
+  emit(as, 0x80); emit(as, 0x78); emit(as, (uint8_t)TOP_AS); emit(as, 0x00); // cmp byte [rax-8], 0
+  jumpTo(as, JE, sizeof(JE), target);
+}
+
+// Compiles one instruction and returns the offset of the next, or -1 when we don't have a template for it.
+static int compileInstruction(Assembler* as, int offset) {
+  Chunk* chunk = as->chunk;
+  uint8_t instruction = chunk->code[offset];
+
+  switch (instruction) {
+    case OP_CONSTANT:
+      pushConstant(as, &chunk->constants.values[chunk->code[offset + 1]]);
+      return offset + 2;
+    case OP_NIL:   pushLiteral(as, VAL_NIL, 0);  return offset + 1;
+    case OP_TRUE:  pushLiteral(as, VAL_BOOL, 1); return offset + 1;
+    case OP_FALSE: pushLiteral(as, VAL_BOOL, 0); return offset + 1;
+    case OP_POP: {
+      static const uint8_t code[] = {0x48, 0x83, 0x2b, 0x10}; // sub qword [rbx], 16
+      emitBytes(as, code, sizeof(code));
+      return offset + 1;
+    }
+    case OP_GET_LOCAL:
+      loadAddress(as, &as->vm->stack[chunk->code[offset + 1]]);
+      pushFromRcx(as);
+      return offset + 2;
+    case OP_SET_LOCAL: {
+      loadAddress(as, &as->vm->stack[chunk->code[offset + 1]]);
+      static const uint8_t code[] = {
+        0x48, 0x8b, 0x03,             // mov rax, [rbx]
+        0xf3, 0x0f, 0x6f, 0x40, 0xf0, // movdqu xmm0, [rax-16]
+        0xf3, 0x0f, 0x7f, 0x01,       // movdqu [rcx], xmm0
+      };
+      emitBytes(as, code, sizeof(code));
+      return offset + 2;
+    }
+    case OP_GET_GLOBAL:
+      callHelper(as, helperGetGlobal, chunk->code[offset + 1], offset);
+      return offset + 2;
+    case OP_DEFINE_GLOBAL:
+      callHelper(as, helperDefineGlobal, chunk->code[offset + 1], offset);
+      return offset + 2;
+    case OP_SET_GLOBAL:
+      callHelper(as, helperSetGlobal, chunk->code[offset + 1], offset);
+      return offset + 2;
+    case OP_EQUAL:
+      callHelper(as, helperEqual, 0, offset);
+      return offset + 1;
+    case OP_GREATER:
+      guardNumbers(as, offset);
+      numberComparison(as, true);
+      return offset + 1;
+    case OP_LESS:
+      guardNumbers(as, offset);
+      numberComparison(as, false);
+      return offset + 1;
+    case OP_ADD: {
+      // Numbers inline, two strings through the helper, anything else is the interpreter's problem.
+      loadTop(as);
+      intsToDoubles(as);
+      emit(as, 0x83); emit(as, 0x78); emit(as, (uint8_t)SECOND_TYPE); emit(as, VAL_NUMBER); // cmp dword [rax-32], VAL_NUMBER
+      emit(as, 0x75); int first = as->count; emit(as, 0);                                   // jne slow
+      emit(as, 0x83); emit(as, 0x78); emit(as, (uint8_t)TOP_TYPE); emit(as, VAL_NUMBER);    // cmp dword [rax-16], VAL_NUMBER
+      emit(as, 0x75); int second = as->count; emit(as, 0);                                  // jne slow
+      numberArithmetic(as, 0x58);
+      emit(as, 0xe9); int done = as->count; emit32(as, 0);                                  // jmp done
+
+      as->buffer[first] = (uint8_t)(as->count - first - 1);
+      as->buffer[second] = (uint8_t)(as->count - second - 1);
+      callHelper(as, helperAdd, 0, offset);
+      patch32(as, done, as->count - done - 4);
+      return offset + 1;
+    }
+    case OP_SUBTRACT: guardNumbers(as, offset); numberArithmetic(as, 0x5c); return offset + 1;
+    case OP_MULTIPLY: guardNumbers(as, offset); numberArithmetic(as, 0x59); return offset + 1;
+    case OP_DIVIDE:   guardNumbers(as, offset); numberArithmetic(as, 0x5e); return offset + 1;
+    case OP_NOT:
+      callHelper(as, helperNot, 0, offset);
+      return offset + 1;
+    case OP_NEGATE:
+      loadTop(as);
+      guardNumber(as, TOP_TYPE, offset);
+      numberNegate(as);
+      return offset + 1;
+    case OP_GREATER_NUM:  loadTop(as); intsToDoubles(as); numberComparison(as, true);  return offset + 1;
+    case OP_LESS_NUM:     loadTop(as); intsToDoubles(as); numberComparison(as, false); return offset + 1;
+    case OP_ADD_NUM:      loadTop(as); intsToDoubles(as); numberArithmetic(as, 0x58);  return offset + 1;
+    case OP_SUBTRACT_NUM: loadTop(as); intsToDoubles(as); numberArithmetic(as, 0x5c);  return offset + 1;
+    case OP_MULTIPLY_NUM: loadTop(as); intsToDoubles(as); numberArithmetic(as, 0x59);  return offset + 1;
+    case OP_DIVIDE_NUM:   loadTop(as); intsToDoubles(as); numberArithmetic(as, 0x5e);  return offset + 1;
+    case OP_NEGATE_NUM:   loadTop(as); intToDouble(as, TOP_TYPE); numberNegate(as);   return offset + 1;
+    case OP_PRINT:
+      callHelper(as, helperPrint, 0, offset);
+      return offset + 1;
+    case OP_CALL:
+      callHelper(as, helperCall, chunk->code[offset + 1], offset);
+      return offset + 2;
+    case OP_ARRAY:
+      callHelper(as, helperArray, chunk->code[offset + 1], offset);
+      return offset + 2;
+    case OP_GET_INDEX:
+      callHelper(as, helperGetIndex, 0, offset);
+      return offset + 1;
+    case OP_SET_INDEX:
+      callHelper(as, helperSetIndex, 0, offset);
+      return offset + 1;
+    case OP_JUMP_SHORT:
+    case OP_JUMP:
+    case OP_JUMP_LONG:
+      jumpTo(as, JMP, sizeof(JMP), jumpTarget(chunk, offset));
+      return offset + instructionLength(instruction);
+    case OP_JUMP_IF_FALSE_SHORT:
+    case OP_JUMP_IF_FALSE:
+    case OP_JUMP_IF_FALSE_LONG:
+      jumpIfFalsey(as, jumpTarget(chunk, offset));
+      return offset + instructionLength(instruction);
+    case OP_LOOP_SHORT:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      // inc qword [&vm->backEdges[loop]], then straight back to the header, which is already compiled.
+      loadAddress(as, &as->vm->backEdges[chunk->code[offset + 1]]);
+      emit(as, 0x48); emit(as, 0xff); emit(as, 0x01);
+      jumpTo(as, JMP, sizeof(JMP), jumpTarget(chunk, offset));
+      return offset + instructionLength(instruction);
+    case OP_GET_LOCAL_0:
+    case OP_GET_LOCAL_1:
+    case OP_GET_LOCAL_2:
+    case OP_GET_LOCAL_3:
+      loadAddress(as, &as->vm->stack[instruction - OP_GET_LOCAL_0]);
+      pushFromRcx(as);
+      return offset + 1;
+    case OP_CONSTANT_0:
+    case OP_CONSTANT_1:
+    case OP_CONSTANT_2:
+    case OP_CONSTANT_3:
+      pushConstant(as, &chunk->constants.values[instruction - OP_CONSTANT_0]);
+      return offset + 1;
+    case OP_ZERO:      pushDouble(as, 0); return offset + 1;
+    case OP_ONE:       pushDouble(as, 1); return offset + 1;
+    case OP_SMALL_INT: pushDouble(as, (int8_t)chunk->code[offset + 1]); return offset + 2;
+    case OP_RETURN:
+      emitReturn(as, JIT_DONE);
+      return offset + 1;
+    default:
+      return -1;
+  }
+}
+
+static void freeAssembler(Assembler* as) {
+  FREE_ARRAY(uint8_t, as->buffer, as->capacity);
+  FREE_ARRAY(int, as->labels, as->chunk->count + 1);
+  FREE_ARRAY(Patch, as->jumps, as->jumpCapacity);
+  FREE_ARRAY(Patch, as->exits, as->exitCapacity);
+  FREE_ARRAY(Patch, as->returns, as->returnCapacity);
+}
+
+bool jitCompile(VM* vm, Chunk* chunk, JitCode* jit) {
+  Assembler as;
+  memset(&as, 0, sizeof(Assembler));
+  as.vm = vm;
+  as.chunk = chunk;
+  as.labels = ALLOCATE(int, chunk->count + 1);
+  for (int i = 0; i <= chunk->count; i++) as.labels[i] = -1;
+
+  // push rbx; mov rbx, &vm->stackTop
+  emit(&as, 0x53);
+  emit(&as, 0x48); emit(&as, 0xbb); emit64(&as, (uint64_t)(uintptr_t)&vm->stackTop);
+
+  int offset = 0;
+  while (offset < chunk->count) {
+    as.labels[offset] = as.count;
+    int next = compileInstruction(&as, offset);
+    if (next < 0) {
+      // No template for this one, so native code ends here and the interpreter runs the rest.
+      emitReturn(&as, offset);
+      break;
+    }
+    offset = next;
+  }
+  // Running off the end can only happen when the chunk has no OP_RETURN, but let's be safe.
+  if (offset >= chunk->count) emitReturn(&as, offset);
+
+  // Every branch to an instruction we never compiled becomes an exit to the interpreter at that instruction.
+  for (int i = 0; i < as.jumpCount; i++) {
+    Patch* jump = &as.jumps[i];
+    if (jump->offset <= chunk->count && as.labels[jump->offset] >= 0) {
+      patch32(&as, jump->at, as.labels[jump->offset] - (jump->at + 4));
+    } else {
+      addPatch(&as.exits, &as.exitCount, &as.exitCapacity, jump->at, jump->offset);
+    }
+  }
+
+  // The shared epilogue, eax already holds the result.
+  int epilogue = as.count;
+  emit(&as, 0x5b); // pop rbx
+  emit(&as, 0xc3); // ret
+
+  // Out of line exit stubs: mov eax, offset; jmp epilogue
+  for (int i = 0; i < as.exitCount; i++) {
+    Patch* exit = &as.exits[i];
+    patch32(&as, exit->at, as.count - (exit->at + 4));
+    emit(&as, 0xb8); emit32(&as, (uint32_t)exit->offset);
+    emit(&as, 0xe9); emit32(&as, (uint32_t)(epilogue - (as.count + 4)));
+  }
+
+  for (int i = 0; i < as.returnCount; i++) {
+    patch32(&as, as.returns[i].at, epilogue - (as.returns[i].at + 4));
+  }
+
+  // Write the code into fresh pages, then flip them to read and execute before we ever run them.
+  size_t size = (size_t)as.count;
+  void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (memory == MAP_FAILED) {
+    freeAssembler(&as);
+    return false;
+  }
+  memcpy(memory, as.buffer, size);
+  if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(memory, size);
+    freeAssembler(&as);
+    return false;
+  }
+
+  jit->code = memory;
+  jit->size = size;
+  jit->entry = (JitEntry)memory;
+  freeAssembler(&as);
+  return true;
+}
+
+void jitFree(JitCode* jit) {
+  if (jit->code != NULL) munmap(jit->code, jit->size);
+  jit->code = NULL;
+  jit->size = 0;
+  jit->entry = NULL;
+}
+
+#else
+
+bool jitCompile(VM* vm, Chunk* chunk, JitCode* jit) {
+  return false;
+}
+
+void jitFree(JitCode* jit) {
+}
+
+#endif
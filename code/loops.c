@@ -0,0 +1,87 @@
+#include <stdlib.h>
+
+#include "../headers/loops.h"
+#include "../headers/memory.h"
+
+LoopStats* newLoopStats() {
+  LoopStats* stats = ALLOCATE(LoopStats, 1);
+  stats->records = NULL;
+  stats->count = 0;
+  stats->capacity = 0;
+  return stats;
+}
+
+void freeLoopStats(LoopStats* stats) {
+  FREE_ARRAY(LoopRecord, stats->records, stats->capacity);
+  FREE(LoopStats, stats);
+}
+
+// Loops are few enough that a linear search is all we need.
+static LoopRecord* findRecord(LoopStats* stats, int line, int loop) {
+  for (int i = 0; i < stats->count; i++) {
+    if (stats->records[i].line == line && stats->records[i].loop == loop) return &stats->records[i];
+  }
+
+  if (stats->capacity < stats->count + 1) {
+    int oldCapacity = stats->capacity;
+    stats->capacity = GROW_CAPACITY(oldCapacity);
+    stats->records = GROW_ARRAY(LoopRecord, stats->records, oldCapacity, stats->capacity);
+  }
+  LoopRecord* record = &stats->records[stats->count++];
+  record->line = line;
+  record->loop = loop;
+  record->backEdges = 0;
+  record->runs = 0;
+  return record;
+}
+
+void collectLoops(LoopStats* stats, VM* vm, Chunk* chunk) {
+  // The counters are indexed by loop number, so walk the code for the OP_LOOP each one belongs to,
+  // its jump tells us where the header is. The loops sharing the last counter are reported once, under
+  // the first of them, otherwise we'd add the same count for each one.
+  bool shared = false;
+  for (int offset = 0; offset < chunk->count;) {
+    uint8_t opcode = chunk->code[offset];
+    int length = instructionLength(opcode);
+    if (length < 0) return;
+
+    if (jumpOpcode(opcode, 2) == OP_LOOP && offset + length <= chunk->count) {
+      int loop = chunk->code[offset + 1];
+      if (loop == SHARED_LOOP && shared) {
+        offset += length;
+        continue;
+      }
+      if (loop == SHARED_LOOP) shared = true;
+
+      LoopRecord* record = findRecord(stats, getLine(chunk, jumpTarget(chunk, offset)), loop);
+      record->backEdges += vm->backEdges[loop];
+      record->runs++;
+    }
+    offset += length;
+  }
+}
+
+static int compareRecords(const void* a, const void* b) {
+  uint64_t left = ((const LoopRecord*)a)->backEdges;
+  uint64_t right = ((const LoopRecord*)b)->backEdges;
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void printLoops(LoopStats* stats, FILE* out) {
+  qsort(stats->records, stats->count, sizeof(LoopRecord), compareRecords);
+
+  int hot = 0;
+  for (int i = 0; i < stats->count; i++) {
+    if (stats->records[i].backEdges >= HOT_LOOP_THRESHOLD) hot++;
+  }
+  fprintf(out, "== loops, %d of %d hot (%d or more back-edges) ==\n", hot, stats->count, HOT_LOOP_THRESHOLD);
+
+  for (int i = 0; i < stats->count; i++) {
+    LoopRecord* record = &stats->records[i];
+    if (record->backEdges == 0) continue;
+    fprintf(out, "line %-6d %14llu back-edges", record->line, (unsigned long long)record->backEdges);
+    if (record->runs > 1) fprintf(out, " in %d runs", record->runs);
+    if (record->loop == SHARED_LOOP) fprintf(out, " with every later loop");
+    fprintf(out, "%s\n", record->backEdges >= HOT_LOOP_THRESHOLD ? "   hot" : "");
+  }
+}
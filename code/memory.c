@@ -11,6 +11,7 @@
 
 #include <stdlib.h>
 #include "../headers/memory.h"
+#include "../headers/object.h"
 #include "../headers/vm.h"
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
@@ -39,11 +40,28 @@ static void freeObject(Obj* object) {
       FREE(ObjString, object);
       break;
     }
+    case OBJ_NATIVE:
+      // The built-ins are static and shared by every VM, they never make it onto a VM's list.
+      break;
+    case OBJ_ARRAY: {
+      ObjArray* array = (ObjArray*)object;
+      if (array->kind == ARRAY_NUMBERS) {
+        FREE_ARRAY(double, array->as.numbers, array->capacity);
+      } else {
+        FREE_ARRAY(Value, array->as.values, array->capacity);
+      }
+      FREE(ObjArray, object);
+      break;
+    }
+    case OBJ_SLICE:
+      // The characters belong to the owner.
+      FREE(ObjSlice, object);
+      break;
   }
 }
 
-void freeObjects() {
-  Obj* object = vm.objects;
+void freeObjects(VM* vm) {
+  Obj* object = vm->objects;
   while (object != NULL) {
     Obj* next = object->next;
     freeObject(object);
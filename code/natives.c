@@ -0,0 +1,271 @@
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "../headers/array.h"
+#include "../headers/natives.h"
+#include "../headers/object.h"
+#include "../headers/table.h"
+#include "../headers/text.h"
+
+// Seconds of CPU time since the process started, enough for a script to time itself.
+static const char* clockNative(VM* vm, int argCount, Value* args) {
+  args[-1] = NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+  return NULL;
+}
+
+static const char* sqrtNative(VM* vm, int argCount, Value* args) {
+  if (!IS_NUMBER(args[0])) return "sqrt() expects a number.";
+  args[-1] = NUMBER_VAL(sqrt(AS_NUMBER(args[0])));
+  return NULL;
+}
+
+static const char* floorNative(VM* vm, int argCount, Value* args) {
+  if (!IS_NUMBER(args[0])) return "floor() expects a number.";
+  args[-1] = NUMBER_VAL(floor(AS_NUMBER(args[0])));
+  return NULL;
+}
+
+// min() and max() take one or more numbers. A NaN only wins if it comes first, same as a chain of ifs would.
+static const char* minNative(VM* vm, int argCount, Value* args) {
+  if (argCount == 0) return "min() expects at least one number.";
+  for (int i = 0; i < argCount; i++) {
+    if (!IS_NUMBER(args[i])) return "min() expects numbers.";
+  }
+
+  double result = AS_NUMBER(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    if (AS_NUMBER(args[i]) < result) result = AS_NUMBER(args[i]);
+  }
+  args[-1] = NUMBER_VAL(result);
+  return NULL;
+}
+
+static const char* maxNative(VM* vm, int argCount, Value* args) {
+  if (argCount == 0) return "max() expects at least one number.";
+  for (int i = 0; i < argCount; i++) {
+    if (!IS_NUMBER(args[i])) return "max() expects numbers.";
+  }
+
+  double result = AS_NUMBER(args[0]);
+  for (int i = 1; i < argCount; i++) {
+    if (AS_NUMBER(args[i]) > result) result = AS_NUMBER(args[i]);
+  }
+  args[-1] = NUMBER_VAL(result);
+  return NULL;
+}
+
+// array(n) makes n zeros, array(n, fill) n copies of fill.
+static const char* arrayNative(VM* vm, int argCount, Value* args) {
+  if (argCount < 1 || argCount > 2) return "array() expects a length and an optional fill value.";
+  if (!IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0 || AS_NUMBER(args[0]) != floor(AS_NUMBER(args[0])) ||
+      AS_NUMBER(args[0]) > INT32_MAX) {
+    return "array() length must be a whole number.";
+  }
+
+  int count = (int)AS_NUMBER(args[0]);
+  Value fill = argCount == 2 ? args[1] : NUMBER_VAL(0);
+  ObjArray* array = newArray(vm, IS_NUMBER(fill) ? ARRAY_NUMBERS : ARRAY_VALUES, count);
+  for (int i = 0; i < count; i++) {
+    if (IS_NUMBER(fill)) {
+      array->as.numbers[i] = AS_NUMBER(fill);
+    } else {
+      array->as.values[i] = fill;
+    }
+  }
+  args[-1] = OBJ_VAL(array);
+  return NULL;
+}
+
+static const char* lenNative(VM* vm, int argCount, Value* args) {
+  if (IS_ARRAY(args[0])) {
+    args[-1] = INT_VAL(AS_ARRAY(args[0])->count);
+  } else if (isText(args[0])) {
+    int length;
+    textChars(args[0], &length);
+    args[-1] = INT_VAL(length);
+  } else {
+    return "len() expects an array or a string.";
+  }
+  return NULL;
+}
+
+// Appends and returns the array, so pushes can be chained.
+static const char* pushNative(VM* vm, int argCount, Value* args) {
+  if (!IS_ARRAY(args[0])) return "push() expects an array.";
+  appendArray(AS_ARRAY(args[0]), args[1]);
+  args[-1] = args[0];
+  return NULL;
+}
+
+// The bulk operations only take arrays of numbers, they check everything before touching anything.
+static const char* sumNative(VM* vm, int argCount, Value* args) {
+  if (!IS_ARRAY(args[0]) || !unboxArray(AS_ARRAY(args[0]))) return "sum() expects an array of numbers.";
+  ObjArray* array = AS_ARRAY(args[0]);
+  args[-1] = NUMBER_VAL(sumNumbers(array->as.numbers, array->count));
+  return NULL;
+}
+
+static const char* dotNative(VM* vm, int argCount, Value* args) {
+  if (!IS_ARRAY(args[0]) || !IS_ARRAY(args[1]) || !unboxArray(AS_ARRAY(args[0])) || !unboxArray(AS_ARRAY(args[1]))) {
+    return "dot() expects two arrays of numbers.";
+  }
+  ObjArray* a = AS_ARRAY(args[0]);
+  ObjArray* b = AS_ARRAY(args[1]);
+  if (a->count != b->count) return "dot() expects arrays of the same length.";
+  args[-1] = NUMBER_VAL(dotNumbers(a->as.numbers, b->as.numbers, a->count));
+  return NULL;
+}
+
+// scale(a, k) multiplies every element of a by k in place and returns a.
+static const char* scaleNative(VM* vm, int argCount, Value* args) {
+  if (!IS_ARRAY(args[0]) || !IS_NUMBER(args[1]) || !unboxArray(AS_ARRAY(args[0]))) {
+    return "scale() expects an array of numbers and a number.";
+  }
+  ObjArray* array = AS_ARRAY(args[0]);
+  scaleNumbers(array->as.numbers, array->count, AS_NUMBER(args[1]));
+  args[-1] = args[0];
+  return NULL;
+}
+
+// mapAdd(a, x) adds x to every element of a in place, x being a number or an array as long as a.
+static const char* mapAddNative(VM* vm, int argCount, Value* args) {
+  if (!IS_ARRAY(args[0]) || !unboxArray(AS_ARRAY(args[0]))) return "mapAdd() expects an array of numbers.";
+  ObjArray* array = AS_ARRAY(args[0]);
+
+  if (IS_NUMBER(args[1])) {
+    addScalar(array->as.numbers, array->count, AS_NUMBER(args[1]));
+  } else if (IS_ARRAY(args[1]) && unboxArray(AS_ARRAY(args[1]))) {
+    ObjArray* addend = AS_ARRAY(args[1]);
+    if (addend->count != array->count) return "mapAdd() expects arrays of the same length.";
+    addNumbers(array->as.numbers, addend->as.numbers, array->count);
+  } else {
+    return "mapAdd() expects a number or an array of numbers to add.";
+  }
+  args[-1] = args[0];
+  return NULL;
+}
+
+// The string natives take strings and slices alike, and none of them copy characters.
+
+// A position within a string of the given length, a whole number from 0 to length.
+static bool textPosition(Value value, int length, int* position) {
+  if (!IS_NUMBER(value)) return false;
+  double number = AS_NUMBER(value);
+  if (number != floor(number) || number < 0 || number > length) return false;
+  *position = (int)number;
+  return true;
+}
+
+// A slice of the characters text has from start on. A slice of a slice points into the same owner.
+static Value sliceText(VM* vm, Value text, int start, int length) {
+  if (IS_SLICE(text)) {
+    ObjSlice* slice = AS_SLICE(text);
+    return newSlice(vm, slice->owner, (int)(slice->chars - slice->owner->chars) + start, length);
+  }
+  return newSlice(vm, AS_STRING(text), start, length);
+}
+
+// slice(s, start) is everything from start on, slice(s, start, end) stops before end.
+static const char* sliceNative(VM* vm, int argCount, Value* args) {
+  if (argCount < 2 || argCount > 3) return "slice() expects a string, a start and an optional end.";
+  if (!isText(args[0])) return "slice() expects a string.";
+
+  int length;
+  textChars(args[0], &length);
+  int start, end = length;
+  if (!textPosition(args[1], length, &start) || (argCount == 3 && !textPosition(args[2], length, &end)) ||
+      end < start) {
+    return "slice() range out of bounds.";
+  }
+  args[-1] = sliceText(vm, args[0], start, end - start);
+  return NULL;
+}
+
+// find(s, needle) is where needle first shows up in s, or -1. find(s, needle, from) starts looking at from.
+static const char* findNative(VM* vm, int argCount, Value* args) {
+  if (argCount < 2 || argCount > 3) return "find() expects a string, what to find and an optional start.";
+  if (!isText(args[0]) || !isText(args[1])) return "find() expects two strings.";
+
+  int length, needleLength;
+  const char* chars = textChars(args[0], &length);
+  const char* needle = textChars(args[1], &needleLength);
+  int from = 0;
+  if (argCount == 3 && !textPosition(args[2], length, &from)) return "find() start out of bounds.";
+
+  int found = findChars(chars + from, length - from, needle, needleLength);
+  args[-1] = INT_VAL(found < 0 ? -1 : from + found);
+  return NULL;
+}
+
+static const char* containsNative(VM* vm, int argCount, Value* args) {
+  if (!isText(args[0]) || !isText(args[1])) return "contains() expects two strings.";
+
+  int length, needleLength;
+  const char* chars = textChars(args[0], &length);
+  const char* needle = textChars(args[1], &needleLength);
+  args[-1] = BOOL_VAL(findChars(chars, length, needle, needleLength) >= 0);
+  return NULL;
+}
+
+// An array of slices of s, the pieces between the separators, so n separators always make n + 1 pieces.
+static const char* splitNative(VM* vm, int argCount, Value* args) {
+  if (!isText(args[0]) || !isText(args[1])) return "split() expects two strings.";
+
+  int length, separatorLength;
+  const char* chars = textChars(args[0], &length);
+  const char* separator = textChars(args[1], &separatorLength);
+  if (separatorLength == 0) return "split() separator can't be empty.";
+
+  ObjArray* pieces = newArray(vm, ARRAY_VALUES, 0);
+  int start = 0;
+  for (;;) {
+    int found = findChars(chars + start, length - start, separator, separatorLength);
+    int end = found < 0 ? length : start + found;
+    appendArray(pieces, sliceText(vm, args[0], start, end - start));
+    if (found < 0) break;
+    start = end + separatorLength;
+  }
+  args[-1] = OBJ_VAL(pieces);
+  return NULL;
+}
+
+// compare(a, b) orders two strings byte by byte, -1 if a comes first, 1 if b does and 0 if they're equal.
+static const char* compareNative(VM* vm, int argCount, Value* args) {
+  if (!isText(args[0]) || !isText(args[1])) return "compare() expects two strings.";
+
+  int aLength, bLength;
+  const char* a = textChars(args[0], &aLength);
+  const char* b = textChars(args[1], &bLength);
+  args[-1] = INT_VAL(compareChars(a, aLength, b, bLength));
+  return NULL;
+}
+
+// Nothing in here ever changes, so one copy serves every VM on every thread.
+static ObjNative natives[] = {
+  {{OBJ_NATIVE, NULL}, clockNative, 0,  "clock"},
+  {{OBJ_NATIVE, NULL}, sqrtNative,  1,  "sqrt"},
+  {{OBJ_NATIVE, NULL}, floorNative, 1,  "floor"},
+  {{OBJ_NATIVE, NULL}, minNative,   -1, "min"},
+  {{OBJ_NATIVE, NULL}, maxNative,   -1, "max"},
+  {{OBJ_NATIVE, NULL}, arrayNative, -1, "array"},
+  {{OBJ_NATIVE, NULL}, lenNative,   1,  "len"},
+  {{OBJ_NATIVE, NULL}, pushNative,  2,  "push"},
+  {{OBJ_NATIVE, NULL}, sumNative,   1,  "sum"},
+  {{OBJ_NATIVE, NULL}, dotNative,   2,  "dot"},
+  {{OBJ_NATIVE, NULL}, scaleNative, 2,  "scale"},
+  {{OBJ_NATIVE, NULL}, mapAddNative, 2, "mapAdd"},
+  {{OBJ_NATIVE, NULL}, sliceNative, -1, "slice"},
+  {{OBJ_NATIVE, NULL}, findNative,  -1, "find"},
+  {{OBJ_NATIVE, NULL}, containsNative, 2, "contains"},
+  {{OBJ_NATIVE, NULL}, splitNative, 2,  "split"},
+  {{OBJ_NATIVE, NULL}, compareNative, 2, "compare"},
+};
+
+void defineNatives(VM* vm) {
+  for (size_t i = 0; i < sizeof(natives) / sizeof(natives[0]); i++) {
+    ObjString* name = copyString(vm, natives[i].name, (int)strlen(natives[i].name));
+    tableSet(&vm->globals, name, OBJ_VAL(&natives[i]));
+  }
+}
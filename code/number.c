@@ -0,0 +1,353 @@
+#include <math.h>
+#include <string.h>
+
+#include "../headers/number.h"
+
+// Shortest round-trip formatting with Grisu2 (Florian Loitsch, "Printing Floating-Point Numbers Quickly
+// and Accurately with Integers", PLDI 2010). The double gets scaled by a cached power of ten so that its
+// neighbourhood, the range of reals that would still round to it, fits in 64 bit fixed point, and digits
+// are generated until the number is pinned down inside that range. Everything is integer arithmetic on
+// a 64 bit significand with a binary exponent, no bignums, no locale, no printf.
+// Grisu2 always produces digits that round-trip. For about one double in a thousand they aren't the
+// shortest possible, 1e23 comes out as 9.999999999999999e+22, which is fine for print.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} DiyFp;
+
+typedef struct {
+  uint64_t f;
+  int e;
+  int k;
+} CachedPower;
+
+// 10^k for k = -300, -292, ..., 324 as normalized DiyFps, rounded to nearest.
+static const CachedPower cachedPowers[] = {
+  {0xAB70FE17C79AC6CA, -1060, -300},
+  {0xFF77B1FCBEBCDC4F, -1034, -292},
+  {0xBE5691EF416BD60C, -1007, -284},
+  {0x8DD01FAD907FFC3C,  -980, -276},
+  {0xD3515C2831559A83,  -954, -268},
+  {0x9D71AC8FADA6C9B5,  -927, -260},
+  {0xEA9C227723EE8BCB,  -901, -252},
+  {0xAECC49914078536D,  -874, -244},
+  {0x823C12795DB6CE57,  -847, -236},
+  {0xC21094364DFB5637,  -821, -228},
+  {0x9096EA6F3848984F,  -794, -220},
+  {0xD77485CB25823AC7,  -768, -212},
+  {0xA086CFCD97BF97F4,  -741, -204},
+  {0xEF340A98172AACE5,  -715, -196},
+  {0xB23867FB2A35B28E,  -688, -188},
+  {0x84C8D4DFD2C63F3B,  -661, -180},
+  {0xC5DD44271AD3CDBA,  -635, -172},
+  {0x936B9FCEBB25C996,  -608, -164},
+  {0xDBAC6C247D62A584,  -582, -156},
+  {0xA3AB66580D5FDAF6,  -555, -148},
+  {0xF3E2F893DEC3F126,  -529, -140},
+  {0xB5B5ADA8AAFF80B8,  -502, -132},
+  {0x87625F056C7C4A8B,  -475, -124},
+  {0xC9BCFF6034C13053,  -449, -116},
+  {0x964E858C91BA2655,  -422, -108},
+  {0xDFF9772470297EBD,  -396, -100},
+  {0xA6DFBD9FB8E5B88F,  -369,  -92},
+  {0xF8A95FCF88747D94,  -343,  -84},
+  {0xB94470938FA89BCF,  -316,  -76},
+  {0x8A08F0F8BF0F156B,  -289,  -68},
+  {0xCDB02555653131B6,  -263,  -60},
+  {0x993FE2C6D07B7FAC,  -236,  -52},
+  {0xE45C10C42A2B3B06,  -210,  -44},
+  {0xAA242499697392D3,  -183,  -36},
+  {0xFD87B5F28300CA0E,  -157,  -28},
+  {0xBCE5086492111AEB,  -130,  -20},
+  {0x8CBCCC096F5088CC,  -103,  -12},
+  {0xD1B71758E219652C,   -77,   -4},
+  {0x9C40000000000000,   -50,    4},
+  {0xE8D4A51000000000,   -24,   12},
+  {0xAD78EBC5AC620000,     3,   20},
+  {0x813F3978F8940984,    30,   28},
+  {0xC097CE7BC90715B3,    56,   36},
+  {0x8F7E32CE7BEA5C70,    83,   44},
+  {0xD5D238A4ABE98068,   109,   52},
+  {0x9F4F2726179A2245,   136,   60},
+  {0xED63A231D4C4FB27,   162,   68},
+  {0xB0DE65388CC8ADA8,   189,   76},
+  {0x83C7088E1AAB65DB,   216,   84},
+  {0xC45D1DF942711D9A,   242,   92},
+  {0x924D692CA61BE758,   269,  100},
+  {0xDA01EE641A708DEA,   295,  108},
+  {0xA26DA3999AEF774A,   322,  116},
+  {0xF209787BB47D6B85,   348,  124},
+  {0xB454E4A179DD1877,   375,  132},
+  {0x865B86925B9BC5C2,   402,  140},
+  {0xC83553C5C8965D3D,   428,  148},
+  {0x952AB45CFA97A0B3,   455,  156},
+  {0xDE469FBD99A05FE3,   481,  164},
+  {0xA59BC234DB398C25,   508,  172},
+  {0xF6C69A72A3989F5C,   534,  180},
+  {0xB7DCBF5354E9BECE,   561,  188},
+  {0x88FCF317F22241E2,   588,  196},
+  {0xCC20CE9BD35C78A5,   614,  204},
+  {0x98165AF37B2153DF,   641,  212},
+  {0xE2A0B5DC971F303A,   667,  220},
+  {0xA8D9D1535CE3B396,   694,  228},
+  {0xFB9B7CD9A4A7443C,   720,  236},
+  {0xBB764C4CA7A44410,   747,  244},
+  {0x8BAB8EEFB6409C1A,   774,  252},
+  {0xD01FEF10A657842C,   800,  260},
+  {0x9B10A4E5E9913129,   827,  268},
+  {0xE7109BFBA19C0C9D,   853,  276},
+  {0xAC2820D9623BF429,   880,  284},
+  {0x80444B5E7AA7CF85,   907,  292},
+  {0xBF21E44003ACDD2D,   933,  300},
+  {0x8E679C2F5E44FF8F,   960,  308},
+  {0xD433179D9C8CB841,   986,  316},
+  {0x9E19DB92B4E31BA9,  1013,  324},
+};
+
+#define CACHED_POWERS_MIN_EXPONENT (-300)
+#define CACHED_POWERS_STEP 8
+
+// The range the scaled binary exponent has to land in, so the integral part of the scaled upper
+// boundary fits in 32 bits and digit generation never overflows.
+#define GRISU_ALPHA (-60)
+#define GRISU_GAMMA (-32)
+
+static DiyFp diySub(DiyFp x, DiyFp y) {
+  return (DiyFp){x.f - y.f, x.e};
+}
+
+// The upper 64 bits of the 128 bit product, rounded. Split into 32 bit halves, since not every
+// compiler we build with has a 128 bit integer type.
+static DiyFp diyMul(DiyFp x, DiyFp y) {
+  uint64_t xLo = x.f & 0xFFFFFFFFu, xHi = x.f >> 32;
+  uint64_t yLo = y.f & 0xFFFFFFFFu, yHi = y.f >> 32;
+
+  uint64_t lowLow = xLo * yLo;
+  uint64_t lowHigh = xLo * yHi;
+  uint64_t highLow = xHi * yLo;
+  uint64_t highHigh = xHi * yHi;
+
+  uint64_t middle = (lowLow >> 32) + (lowHigh & 0xFFFFFFFFu) + (highLow & 0xFFFFFFFFu);
+  middle += (uint64_t)1 << 31; // round to nearest
+  return (DiyFp){highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32), x.e + y.e + 64};
+}
+
+static DiyFp normalize(DiyFp x) {
+  while ((x.f >> 63) == 0) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+static DiyFp normalizeTo(DiyFp x, int e) {
+  return (DiyFp){x.f << (x.e - e), e};
+}
+
+// The double itself and the midpoints to its neighbours below and above, all on the same exponent.
+static void computeBoundaries(double value, DiyFp* minus, DiyFp* w, DiyFp* plus) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint64_t fraction = bits & (((uint64_t)1 << 52) - 1);
+  int exponent = (int)((bits >> 52) & 0x7FF);
+
+  DiyFp v = exponent == 0 ? (DiyFp){fraction, 1 - 1075}
+                          : (DiyFp){fraction + ((uint64_t)1 << 52), exponent - 1075};
+
+  // At a power of two the gap to the next double down is half the gap to the next one up.
+  bool lowerIsCloser = fraction == 0 && exponent > 1;
+  DiyFp upper = {2 * v.f + 1, v.e - 1};
+  DiyFp lower = lowerIsCloser ? (DiyFp){4 * v.f - 1, v.e - 2} : (DiyFp){2 * v.f - 1, v.e - 1};
+
+  *plus = normalize(upper);
+  *minus = normalizeTo(lower, plus->e);
+  *w = normalize(v);
+}
+
+static CachedPower cachedPowerFor(int e) {
+  // ceil((GRISU_ALPHA - e - 1) * log10(2)), 78913 / 2^18 being log10(2) close enough for every exponent a double has.
+  int f = GRISU_ALPHA - e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  int index = (-CACHED_POWERS_MIN_EXPONENT + k + (CACHED_POWERS_STEP - 1)) / CACHED_POWERS_STEP;
+  return cachedPowers[index];
+}
+
+static int largestPow10(uint32_t n, uint32_t* pow10) {
+  static const uint32_t powers[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+  int digits = 10;
+  while (digits > 1 && n < powers[digits - 1]) digits--;
+  *pow10 = powers[digits - 1];
+  return digits;
+}
+
+// Nudges the last digit down while that moves the number closer to w and stays inside the boundaries.
+static void roundWeed(char* buffer, int length, uint64_t distance, uint64_t delta, uint64_t rest, uint64_t tenK) {
+  while (rest < distance && delta - rest >= tenK &&
+         (rest + tenK < distance || distance - rest > rest + tenK - distance)) {
+    buffer[length - 1]--;
+    rest += tenK;
+  }
+}
+
+static int generateDigits(char* buffer, int* exponent, DiyFp minus, DiyFp w, DiyFp plus) {
+  uint64_t delta = diySub(plus, minus).f;
+  uint64_t distance = diySub(plus, w).f;
+  DiyFp one = {(uint64_t)1 << -plus.e, plus.e};
+
+  // The integral and fractional parts of the upper boundary.
+  uint32_t integral = (uint32_t)(plus.f >> -one.e);
+  uint64_t fractional = plus.f & (one.f - 1);
+
+  int length = 0;
+  uint32_t pow10;
+  int remaining = largestPow10(integral, &pow10);
+  while (remaining > 0) {
+    buffer[length++] = (char)('0' + integral / pow10);
+    integral %= pow10;
+    remaining--;
+
+    uint64_t rest = ((uint64_t)integral << -one.e) + fractional;
+    if (rest <= delta) {
+      *exponent += remaining;
+      roundWeed(buffer, length, distance, delta, rest, (uint64_t)pow10 << -one.e);
+      return length;
+    }
+    pow10 /= 10;
+  }
+
+  int fractionDigits = 0;
+  for (;;) {
+    fractional *= 10;
+    delta *= 10;
+    distance *= 10;
+    buffer[length++] = (char)('0' + (fractional >> -one.e));
+    fractional &= one.f - 1;
+    fractionDigits++;
+    if (fractional <= delta) break;
+  }
+  *exponent -= fractionDigits;
+  roundWeed(buffer, length, distance, delta, fractional, one.f);
+  return length;
+}
+
+// The digits of a finite, positive double and the power of ten they're scaled by.
+static int grisu2(double value, char* digits, int* exponent) {
+  DiyFp minus, w, plus;
+  computeBoundaries(value, &minus, &w, &plus);
+
+  CachedPower cached = cachedPowerFor(plus.e);
+  DiyFp power = {cached.f, cached.e};
+  DiyFp scaled = diyMul(w, power);
+  DiyFp scaledMinus = diyMul(minus, power);
+  DiyFp scaledPlus = diyMul(plus, power);
+
+  // The products are off by up to one unit either way, so narrow the range to stay safely inside it.
+  scaledMinus.f++;
+  scaledPlus.f--;
+
+  *exponent = -cached.k;
+  return generateDigits(digits, exponent, scaledMinus, scaled, scaledPlus);
+}
+
+static int writeExponent(char* out, int exponent) {
+  char* start = out;
+  *out++ = 'e';
+  *out++ = exponent < 0 ? '-' : '+';
+  if (exponent < 0) exponent = -exponent;
+  // at least two digits, the way %g does it
+  if (exponent >= 100) *out++ = (char)('0' + exponent / 100);
+  *out++ = (char)('0' + exponent / 10 % 10);
+  *out++ = (char)('0' + exponent % 10);
+  return (int)(out - start);
+}
+
+// Lays out length digits scaled by 10^exponent.
+static int layOut(char* out, const char* digits, int length, int exponent) {
+  char* start = out;
+  int point = length + exponent; // digits in front of the decimal point
+  int leading = point - 1;       // the decimal exponent of the first digit
+
+  if (leading < -4 || leading >= 21) {
+    *out++ = digits[0];
+    if (length > 1) {
+      *out++ = '.';
+      memcpy(out, digits + 1, length - 1);
+      out += length - 1;
+    }
+    out += writeExponent(out, leading);
+  } else if (exponent >= 0) {
+    memcpy(out, digits, length);
+    out += length;
+    memset(out, '0', exponent);
+    out += exponent;
+  } else if (point > 0) {
+    memcpy(out, digits, point);
+    out += point;
+    *out++ = '.';
+    memcpy(out, digits + point, length - point);
+    out += length - point;
+  } else {
+    *out++ = '0';
+    *out++ = '.';
+    memset(out, '0', -point);
+    out += -point;
+    memcpy(out, digits, length);
+    out += length;
+  }
+  return (int)(out - start);
+}
+
+// Integers are by far the most common numbers a script prints, and they don't need any of the above.
+static int formatInteger(char* out, uint64_t integer) {
+  char digits[20];
+  int length = 0;
+  do {
+    digits[length++] = (char)('0' + integer % 10);
+    integer /= 10;
+  } while (integer != 0);
+
+  for (int i = 0; i < length; i++) out[i] = digits[length - 1 - i];
+  return length;
+}
+
+int formatInt(int64_t value, char* buffer) {
+  char* out = buffer;
+  if (value < 0) *out++ = '-';
+  // INT_LIMIT keeps the magnitude far from the one int64_t that can't be negated.
+  int length = formatInteger(out, (uint64_t)(value < 0 ? -value : value));
+  out[length] = '\0';
+  return (int)(out - buffer) + length;
+}
+
+int formatNumber(double value, char* buffer) {
+  char* out = buffer;
+  if (value != value) {
+    memcpy(out, "nan", 4);
+    return 3;
+  }
+  if (signbit(value)) {
+    *out++ = '-';
+    value = -value;
+  }
+
+  int length;
+  if (value == 0) {
+    *out = '0';
+    length = 1;
+  } else if (value > 1.7976931348623157e308) {
+    memcpy(out, "inf", 3);
+    length = 3;
+  } else if (value < 9007199254740992.0 && value == (double)(uint64_t)value) {
+    // Below 2^53 every integer is exact, so its digits are already the shortest ones that round-trip.
+    length = formatInteger(out, (uint64_t)value);
+  } else {
+    char digits[18];
+    int exponent;
+    int count = grisu2(value, digits, &exponent);
+    length = layOut(out, digits, count, exponent);
+  }
+
+  out[length] = '\0';
+  return (int)(out - buffer) + length;
+}
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "../headers/intern.h"
 #include "../headers/memory.h"
 #include "../headers/object.h"
 #include "../headers/value.h"
@@ -16,22 +17,45 @@
 */
 
 #define ALLOCATE_OBJ(type, objectType) \
-  (type*)allocateObject(sizeof(type), objectType)
+  (type*)allocateObject(vm, sizeof(type), objectType)
 
 // code to instantiate a base struct pointer that later gets downcasted to a specific type like String.
-static Obj* allocateObject(size_t size, ObjType type) {
+static Obj* allocateObject(VM* vm, size_t size, ObjType type) {
   Obj* object = (Obj*)reallocate(NULL, 0, size);
   object->type = type;
 
   // updating the head of the intrusive linked list each time
-  object->next = vm.objects;
-  vm.objects = object;
+  object->next = vm->objects;
+  vm->objects = object;
   
   return object;
 }
 
+// Tries to publish a new string in the process-wide intern set. Strings in there belong to the set,
+// not to any VM, so they're left out of vm->objects. Returns NULL if the set is full.
+static ObjString* allocateSharedString(char* chars, int length, uint32_t hash) {
+  ObjString* string = (ObjString*)reallocate(NULL, 0, sizeof(ObjString));
+  string->obj.type = OBJ_STRING;
+  string->obj.next = NULL;
+  string->length = length;
+  string->chars = chars;
+  string->hash = hash;
+
+  ObjString* interned = internSharedString(string);
+  if (interned != string) {
+    // Another thread published the same string first, or there was no room. Either way ours goes.
+    FREE(ObjString, string);
+    if (interned != NULL) FREE_ARRAY(char, chars, length + 1);
+  }
+  return interned;
+}
+
 // The real string creation happens here.
-static ObjString* allocateString(char* chars, int length, uint32_t hash) {
+static ObjString* allocateString(VM* vm, char* chars, int length, uint32_t hash) {
+  if (vm->sharedStrings) {
+    ObjString* shared = allocateSharedString(chars, length, hash);
+    if (shared != NULL) return shared;
+  }
 
   // This instantiates an ObjString type Object on the heap, kind of like calling a super constructor.
   ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
@@ -40,10 +64,18 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash) {
   string->chars = chars;
   string->hash = hash;
   // We're using the table more like a hash set than a hash table
-  tableSet(&vm.strings, string, NIL_VAL);
+  tableSet(&vm->strings, string, NIL_VAL);
   return string;
 }
 
+// A VM on the shared set only keeps strings in its own table once the set has filled up. It looks there first,
+// so a string that ended up local keeps being the one this VM hands out.
+static ObjString* findString(VM* vm, const char* chars, int length, uint32_t hash) {
+  ObjString* interned = tableFindString(&vm->strings, chars, length, hash);
+  if (interned == NULL && vm->sharedStrings) interned = findSharedString(chars, length, hash);
+  return interned;
+}
+
 static uint32_t hashString(const char* key, int length) {
   uint32_t hash = 2166136261u;
   for (int i = 0; i< length; i++) {
@@ -53,25 +85,25 @@ static uint32_t hashString(const char* key, int length) {
   return hash;
 }
 
-ObjString* takeString(char* chars, int length) {
+ObjString* takeString(VM* vm, char* chars, int length) {
   uint32_t hash = hashString(chars, length);
 
   // We look up the string in the string table first, if we find it, before we return it,
   // we free the memory for the string that was passed in.
-  ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+  ObjString* interned = findString(vm, chars, length, hash);
   if (interned != NULL) {
     FREE_ARRAY(char, chars, length + 1);
     return interned;
   }
-  return allocateString(chars, length, hash);
+  return allocateString(vm, chars, length, hash);
 }
 
-ObjString* copyString(const char* chars, int length) {
+ObjString* copyString(VM* vm, const char* chars, int length) {
   uint32_t hash = hashString(chars, length);
 
   // when copying a string into a new lox string, we look it up in the string table first.
   // If we find it, we just retrun a reference to that string. Otherwise, we allocate a new string and store it in the table.
-  ObjString* interned = tableFindString(&vm.strings, chars, length, hash);
+  ObjString* interned = findString(vm, chars, length, hash);
   if (interned != NULL) return interned;
 
   char* heapChars =  ALLOCATE(char, length+1);
@@ -80,13 +112,84 @@ ObjString* copyString(const char* chars, int length) {
   memcpy(heapChars, chars, length);
   // All strings in C are null terminated, unline in Lox
   heapChars[length] = '\0';
-  return allocateString(heapChars, length, hash);
+  return allocateString(vm, heapChars, length, hash);
+}
+
+ObjString* adoptString(VM* vm, const ObjString* string) {
+  // The hash came with the string, so unlike copyString there's nothing to rehash.
+  ObjString* interned = findString(vm, string->chars, string->length, string->hash);
+  if (interned != NULL) return interned;
+
+  char* heapChars = ALLOCATE(char, string->length + 1);
+  memcpy(heapChars, string->chars, string->length + 1);
+  return allocateString(vm, heapChars, string->length, string->hash);
 }
 
-void printObject(Value value) {
+ObjArray* newArray(VM* vm, ArrayKind kind, int count) {
+  ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+  array->kind = kind;
+  array->count = count;
+  array->capacity = count;
+  if (kind == ARRAY_NUMBERS) {
+    array->as.numbers = ALLOCATE(double, count);
+    for (int i = 0; i < count; i++) array->as.numbers[i] = 0;
+  } else {
+    array->as.values = ALLOCATE(Value, count);
+    for (int i = 0; i < count; i++) array->as.values[i] = NIL_VAL;
+  }
+  return array;
+}
+
+Value newSlice(VM* vm, ObjString* owner, int start, int length) {
+  if (start == 0 && length == owner->length) return OBJ_VAL(owner);
+
+  ObjSlice* slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+  slice->owner = owner;
+  slice->chars = owner->chars + start;
+  slice->length = length;
+  return OBJ_VAL(slice);
+}
+
+ObjString* materializeSlice(VM* vm, ObjSlice* slice) {
+  return copyString(vm, slice->chars, slice->length);
+}
+
+// Arrays can hold themselves, so past a few levels we stop going in.
+#define PRINT_DEPTH_MAX 8
+
+static void printArray(FILE* file, ObjArray* array, int depth) {
+  if (depth == PRINT_DEPTH_MAX) {
+    fputs("[...]", file);
+    return;
+  }
+
+  fputc('[', file);
+  for (int i = 0; i < array->count; i++) {
+    if (i > 0) fputs(", ", file);
+    if (array->kind == ARRAY_NUMBERS) {
+      fprintValue(file, NUMBER_VAL(array->as.numbers[i]));
+    } else if (IS_ARRAY(array->as.values[i])) {
+      printArray(file, AS_ARRAY(array->as.values[i]), depth + 1);
+    } else {
+      fprintValue(file, array->as.values[i]);
+    }
+  }
+  fputc(']', file);
+}
+
+void printObject(FILE* file, Value value) {
   switch(OBJ_TYPE(value)) {
     case OBJ_STRING:
-      printf("%s", AS_CSTRING(value));
+      fputs(AS_CSTRING(value), file);
+      break;
+    case OBJ_NATIVE:
+      fprintf(file, "<native fn %s>", AS_NATIVE(value)->name);
+      break;
+    case OBJ_ARRAY:
+      printArray(file, AS_ARRAY(value), 0);
+      break;
+    case OBJ_SLICE:
+      fwrite(AS_SLICE(value)->chars, 1, AS_SLICE(value)->length, file);
       break;
   }
 }
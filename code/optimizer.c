@@ -0,0 +1,737 @@
+/*
+  The optimizing tier. The single pass compiler never looks at more than one expression at a time,
+  so this pass takes the finished chunk and works on all of it at once.
+
+  We lift the bytecode into an array of Instrs whose jumps point at instruction indices instead of byte offsets,
+  then abstractly interpret it over a stack of SSA values. Every value the program computes gets a number, and
+  the same operator applied to the same value numbers gets the same number again (value numbering). Locals are
+  just stack slots in our VM, so a local holds whatever value number was last stored into it, which means copies
+  like `var b = a;` are propagated for free. Where paths join we merge the stacks, a slot keeps its value number
+  only if every incoming path agrees on it, otherwise it gets a fresh one (a phi).
+
+  On top of that:
+    - Common subexpression elimination. When the value on top of the stack already sits in a lower stack slot,
+      the side effect free code that recomputed it is replaced with one OP_GET_LOCAL of that slot.
+    - Dead store elimination. An OP_SET_LOCAL whose value is overwritten or popped before anyone reads it is
+      removed, and so is a store of the value the slot already holds.
+    - Redundant type check removal. Value numbers carry a type, and once a checked operator has succeeded its
+      operands are known to be numbers (or strings), so later generic opcodes on them become the _NUM forms.
+
+  Finally we lower the surviving instructions back into plain bytecode and recompute every jump offset,
+  so run() never knows any of this happened.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/common.h"
+#include "../headers/compiler.h"
+#include "../headers/memory.h"
+#include "../headers/object.h"
+#include "../headers/optimizer.h"
+#include "../headers/vm.h"
+
+typedef struct {
+  uint8_t op;
+  bool deleted;
+  int operand; // constant index or stack slot, for the opcodes that have one
+  int target;  // for jumps, the index of the instruction they land on
+  int line;
+} Instr;
+
+typedef struct {
+  int id; // SSA value number
+  StaticType type;
+  int first; // first instruction of the side effect free code that computed this value, -1 if it can't be removed
+} Slot;
+
+typedef struct {
+  Slot slots[STACK_MAX];
+  int depth;
+} State;
+
+typedef struct {
+  uint8_t op;
+  int a;
+  int b;
+  int id;
+  int generation;
+} ValueKey;
+
+typedef struct {
+  Chunk* chunk;
+  Instr* code;
+  int count;
+  int capacity;
+  bool failed;
+
+  int nextId;
+  // The value numbering table. Keys only hold within a run of code with a single way in,
+  // so instead of clearing it at every join we bump the generation and treat older keys as empty.
+  ValueKey* keys;
+  int keyCapacity;
+  int generation;
+
+  State** pending;  // per instruction, the merged state of the forward jumps that land there
+  bool* backTarget; // per instruction, whether a jump from further down lands there
+  int pendingStore[STACK_MAX]; // the last OP_SET_LOCAL to each slot that nobody has read yet, -1 if none
+  State state;
+} Optimizer;
+
+// nil, true, false, every OP_SMALL_INT operand and every constant in the pool have a value number of their
+// own for the whole chunk.
+#define NIL_ID            0
+#define TRUE_ID           1
+#define FALSE_ID          2
+#define SMALL_INT_ID(i)   (3 + (i))
+#define CONSTANT_ID(i)    (3 + UINT8_COUNT + (i))
+
+static int operandLength(uint8_t op) {
+  switch (op) {
+    case OP_CONSTANT:
+    case OP_GET_LOCAL:
+    case OP_SET_LOCAL:
+    case OP_GET_GLOBAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_CALL:
+    case OP_ARRAY:
+    case OP_SMALL_INT:
+      return 1;
+    case OP_JUMP_SHORT:
+    case OP_JUMP_IF_FALSE_SHORT:
+      return 1;
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP_SHORT:
+      return 2;
+    case OP_LOOP:
+      return 3;
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_LONG:
+      return 4;
+    case OP_LOOP_LONG:
+      return 5;
+    case OP_NIL:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_POP:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_LESS:
+    case OP_ADD:
+    case OP_SUBTRACT:
+    case OP_MULTIPLY:
+    case OP_DIVIDE:
+    case OP_NOT:
+    case OP_NEGATE:
+    case OP_GREATER_NUM:
+    case OP_LESS_NUM:
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE_NUM:
+    case OP_NEGATE_NUM:
+    case OP_PRINT:
+    case OP_GET_INDEX:
+    case OP_SET_INDEX:
+    case OP_GET_LOCAL_0:
+    case OP_GET_LOCAL_1:
+    case OP_GET_LOCAL_2:
+    case OP_GET_LOCAL_3:
+    case OP_CONSTANT_0:
+    case OP_CONSTANT_1:
+    case OP_CONSTANT_2:
+    case OP_CONSTANT_3:
+    case OP_ZERO:
+    case OP_ONE:
+    case OP_RETURN:
+      return 0;
+    default:
+      // Something we don't know how to reason about, so we leave the chunk alone.
+      return -1;
+  }
+}
+
+static bool isJump(uint8_t op) {
+  return jumpWidth(op) > 0;
+}
+
+// ______________ Lifting __________________________
+
+static bool lift(Optimizer* opt) {
+  Chunk* chunk = opt->chunk;
+  // byte offset -> instruction index, -1 for bytes in the middle of an instruction
+  int* indexOf = ALLOCATE(int, chunk->count + 1);
+  for (int i = 0; i <= chunk->count; i++) indexOf[i] = -1;
+
+  // Count the instructions first so we don't need an Instr for every byte.
+  int count = 0;
+  for (int offset = 0; offset < chunk->count; count++) {
+    int length = operandLength(chunk->code[offset]);
+    if (length < 0) {
+      FREE_ARRAY(int, indexOf, chunk->count + 1);
+      return false;
+    }
+    offset += 1 + length;
+  }
+
+  opt->code = ALLOCATE(Instr, count);
+  opt->capacity = count;
+  opt->count = 0;
+
+  int offset = 0;
+  int run = 0; // walking the line runs alongside the code is cheaper than a getLine() per instruction
+  while (offset < chunk->count) {
+    uint8_t op = chunk->code[offset];
+    int length = operandLength(op);
+    if (offset + length >= chunk->count) {
+      FREE_ARRAY(int, indexOf, chunk->count + 1);
+      return false;
+    }
+
+    Instr* instr = &opt->code[opt->count];
+    instr->operand = 0;
+    // Compact forms are worked on as their long forms, lowering picks the compact ones again.
+    instr->op = expandOpcode(op, &instr->operand);
+    instr->target = -1;
+    while (run + 1 < chunk->lineCount && chunk->lines[run + 1].offset <= offset) run++;
+    instr->line = chunk->lineCount > 0 ? chunk->lines[run].line : 0;
+    instr->deleted = false;
+
+    if (length == 1) instr->operand = chunk->code[offset + 1];
+    // For now the target holds the byte offset the jump lands on, it's resolved to an index below.
+    // Every width of a jump is the same jump to us, lowering works out the widths again.
+    if (isJump(op)) {
+      instr->op = jumpOpcode(op, 2);
+      if (instr->op == OP_LOOP) instr->operand = chunk->code[offset + 1];
+      instr->target = jumpTarget(chunk, offset);
+    }
+
+    indexOf[offset] = opt->count++;
+    offset += 1 + length;
+  }
+  indexOf[chunk->count] = opt->count;
+
+  opt->backTarget = ALLOCATE(bool, opt->count + 1);
+  opt->pending = ALLOCATE(State*, opt->count + 1);
+  for (int i = 0; i <= opt->count; i++) {
+    opt->backTarget[i] = false;
+    opt->pending[i] = NULL;
+  }
+
+  bool valid = true;
+  for (int i = 0; i < opt->count; i++) {
+    Instr* instr = &opt->code[i];
+    if (!isJump(instr->op)) continue;
+
+    if (instr->target < 0 || instr->target > chunk->count || indexOf[instr->target] < 0) {
+      valid = false;
+      break;
+    }
+    instr->target = indexOf[instr->target];
+    if (instr->target <= i) opt->backTarget[instr->target] = true;
+  }
+
+  FREE_ARRAY(int, indexOf, chunk->count + 1);
+  return valid;
+}
+
+// ______________ Value numbering __________________________
+
+static int freshValue(Optimizer* opt) {
+  return opt->nextId++;
+}
+
+// Operators that compute the same value from the same inputs share a key.
+static uint8_t canonicalOp(uint8_t op) {
+  switch (op) {
+    case OP_GREATER_NUM:  return OP_GREATER;
+    case OP_LESS_NUM:     return OP_LESS;
+    case OP_ADD_NUM:      return OP_ADD;
+    case OP_SUBTRACT_NUM: return OP_SUBTRACT;
+    case OP_MULTIPLY_NUM: return OP_MULTIPLY;
+    case OP_DIVIDE_NUM:   return OP_DIVIDE;
+    case OP_NEGATE_NUM:   return OP_NEGATE;
+    default:              return op;
+  }
+}
+
+static int numberValue(Optimizer* opt, uint8_t op, int a, int b) {
+  op = canonicalOp(op);
+  // Equality and multiplication don't care about operand order.
+  if ((op == OP_EQUAL || op == OP_MULTIPLY) && a > b) {
+    int swap = a;
+    a = b;
+    b = swap;
+  }
+
+  uint32_t hash = (uint32_t)op * 0x9e3779b1u ^ (uint32_t)a * 0x85ebca77u ^ (uint32_t)b * 0xc2b2ae3du;
+  hash ^= hash >> 15;
+  hash *= 0x2c1b3c6du;
+  hash ^= hash >> 12;
+  uint32_t index = hash & (uint32_t)(opt->keyCapacity - 1);
+  for (;;) {
+    ValueKey* key = &opt->keys[index];
+    if (key->generation != opt->generation) {
+      key->op = op;
+      key->a = a;
+      key->b = b;
+      key->id = freshValue(opt);
+      key->generation = opt->generation;
+      return key->id;
+    }
+    if (key->op == op && key->a == a && key->b == b) return key->id;
+
+    index = (index + 1) & (uint32_t)(opt->keyCapacity - 1);
+  }
+}
+
+// ______________ Abstract interpretation __________________________
+
+static Slot* top(Optimizer* opt) {
+  return &opt->state.slots[opt->state.depth - 1];
+}
+
+static void pushSlot(Optimizer* opt, int id, StaticType type, int first) {
+  if (opt->state.depth == STACK_MAX) {
+    opt->failed = true;
+    return;
+  }
+
+  Slot* slot = &opt->state.slots[opt->state.depth++];
+  slot->id = id;
+  slot->type = type;
+  slot->first = first;
+}
+
+static Slot popSlot(Optimizer* opt, bool read) {
+  if (opt->state.depth == 0) {
+    opt->failed = true;
+    return (Slot){freshValue(opt), TYPE_UNKNOWN, -1};
+  }
+
+  int slot = --opt->state.depth;
+  int store = opt->pendingStore[slot];
+  // An OP_POP throws the slot away, so a store into it that nobody read was pointless.
+  if (!read && store != -1) opt->code[store].deleted = true;
+  opt->pendingStore[slot] = -1;
+  return opt->state.slots[slot];
+}
+
+// Once a checked operator has gone through, its operands must have had the type it checks for.
+static void refine(Optimizer* opt, int id, StaticType type) {
+  for (int i = 0; i < opt->state.depth; i++) {
+    if (opt->state.slots[i].id == id) opt->state.slots[i].type = type;
+  }
+}
+
+static StaticType constantType(Value value) {
+  if (IS_NUMBER(value)) return TYPE_NUMBER;
+  if (IS_BOOL(value)) return TYPE_BOOL;
+  if (IS_NIL(value)) return TYPE_NIL;
+  if (IS_STRING(value)) return TYPE_STRING;
+  return TYPE_UNKNOWN;
+}
+
+// The code for the value on top of the stack is side effect free. If the same value is already
+// sitting further down the stack, we can read it from there instead of computing it again.
+static void reuseValue(Optimizer* opt, int index) {
+  Slot* value = top(opt);
+  // Replacing a single instruction with another single instruction gains nothing.
+  if (value->first < 0 || value->first == index) return;
+
+  for (int slot = 0; slot < opt->state.depth - 1 && slot <= UINT8_MAX; slot++) {
+    if (opt->state.slots[slot].id != value->id) continue;
+
+    for (int i = value->first; i < index; i++) opt->code[i].deleted = true;
+    opt->code[index].op = OP_GET_LOCAL;
+    opt->code[index].operand = slot;
+    value->first = index;
+    opt->pendingStore[slot] = -1;
+    return;
+  }
+}
+
+static void forgetStores(Optimizer* opt) {
+  for (int i = 0; i < STACK_MAX; i++) opt->pendingStore[i] = -1;
+}
+
+// Nothing in the current run of code can be deleted across a block boundary.
+static void startBlock(Optimizer* opt) {
+  opt->generation++;
+  forgetStores(opt);
+  for (int i = 0; i < opt->state.depth; i++) opt->state.slots[i].first = -1;
+}
+
+static void mergeStates(Optimizer* opt, State* into, State* from) {
+  if (into->depth != from->depth) {
+    opt->failed = true;
+    return;
+  }
+
+  for (int i = 0; i < into->depth; i++) {
+    Slot* a = &into->slots[i];
+    Slot* b = &from->slots[i];
+    if (a->type != b->type) a->type = TYPE_UNKNOWN;
+    if (a->id != b->id) a->id = freshValue(opt);
+    a->first = -1;
+  }
+}
+
+static void jumpTo(Optimizer* opt, int target) {
+  // Loop headers start from nothing anyway, there's no point tracking what flows into them.
+  if (opt->backTarget[target]) return;
+
+  if (opt->pending[target] == NULL) {
+    opt->pending[target] = ALLOCATE(State, 1);
+    *opt->pending[target] = opt->state;
+    return;
+  }
+  mergeStates(opt, opt->pending[target], &opt->state);
+}
+
+static bool hasOperands(Optimizer* opt, int count) {
+  if (opt->state.depth >= count) return true;
+  opt->failed = true;
+  return false;
+}
+
+static void binaryValue(Optimizer* opt, int index, StaticType type) {
+  Instr* instr = &opt->code[index];
+  Slot b = popSlot(opt, true);
+  Slot a = popSlot(opt, true);
+  int first = a.first >= 0 && b.first >= 0 ? a.first : -1;
+  pushSlot(opt, numberValue(opt, instr->op, a.id, b.id), type, first);
+}
+
+// Checked numeric operators: specialize them when both operands are known numbers,
+// and either way, if we get past them the operands were numbers.
+static void numericOp(Optimizer* opt, int index, uint8_t numberOp, StaticType result) {
+  Instr* instr = &opt->code[index];
+  if (!hasOperands(opt, 2)) return;
+  Slot* b = &opt->state.slots[opt->state.depth - 1];
+  Slot* a = &opt->state.slots[opt->state.depth - 2];
+  if (a->type == TYPE_NUMBER && b->type == TYPE_NUMBER) instr->op = numberOp;
+
+  int left = a->id;
+  int right = b->id;
+  binaryValue(opt, index, result);
+  refine(opt, left, TYPE_NUMBER);
+  refine(opt, right, TYPE_NUMBER);
+}
+
+static void addOp(Optimizer* opt, int index) {
+  if (!hasOperands(opt, 2)) return;
+  Slot* b = &opt->state.slots[opt->state.depth - 1];
+  Slot* a = &opt->state.slots[opt->state.depth - 2];
+
+  // OP_ADD only succeeds on two numbers or two strings, so one known side tells us the other.
+  StaticType known = TYPE_UNKNOWN;
+  if (a->type == TYPE_NUMBER || b->type == TYPE_NUMBER) known = TYPE_NUMBER;
+  if (a->type == TYPE_STRING || b->type == TYPE_STRING) known = TYPE_STRING;
+  if (a->type == TYPE_NUMBER && b->type == TYPE_NUMBER) opt->code[index].op = OP_ADD_NUM;
+
+  int left = a->id;
+  int right = b->id;
+  binaryValue(opt, index, known);
+  if (known != TYPE_UNKNOWN) {
+    refine(opt, left, known);
+    refine(opt, right, known);
+  }
+}
+
+static bool producesValue(uint8_t op) {
+  switch (op) {
+    case OP_POP:
+    case OP_SET_LOCAL:
+    case OP_DEFINE_GLOBAL:
+    case OP_SET_GLOBAL:
+    case OP_PRINT:
+    case OP_JUMP:
+    case OP_JUMP_IF_FALSE:
+    case OP_LOOP:
+    case OP_RETURN:
+      return false;
+    default:
+      return true;
+  }
+}
+
+static void interpretInstr(Optimizer* opt, int index) {
+  Instr* instr = &opt->code[index];
+  bool produced = producesValue(instr->op);
+  switch (instr->op) {
+    case OP_CONSTANT: {
+      Value value = opt->chunk->constants.values[instr->operand];
+      pushSlot(opt, CONSTANT_ID(instr->operand), constantType(value), index);
+      break;
+    }
+    case OP_SMALL_INT: pushSlot(opt, SMALL_INT_ID(instr->operand), TYPE_NUMBER, index); break;
+    case OP_NIL:   pushSlot(opt, NIL_ID, TYPE_NIL, index);    break;
+    case OP_TRUE:  pushSlot(opt, TRUE_ID, TYPE_BOOL, index);  break;
+    case OP_FALSE: pushSlot(opt, FALSE_ID, TYPE_BOOL, index); break;
+    case OP_POP:   popSlot(opt, false); break;
+    case OP_GET_LOCAL: {
+      if (instr->operand >= opt->state.depth) {
+        opt->failed = true;
+        return;
+      }
+      Slot local = opt->state.slots[instr->operand];
+      opt->pendingStore[instr->operand] = -1;
+      pushSlot(opt, local.id, local.type, index);
+      break;
+    }
+    case OP_SET_LOCAL: {
+      if (instr->operand >= opt->state.depth - 1) {
+        opt->failed = true;
+        return;
+      }
+      Slot* local = &opt->state.slots[instr->operand];
+      Slot* value = top(opt);
+
+      // Storing the value the local already holds does nothing.
+      if (local->id == value->id) {
+        instr->deleted = true;
+        break;
+      }
+
+      // The previous store was never read before this one overwrote it.
+      int store = opt->pendingStore[instr->operand];
+      if (store != -1) opt->code[store].deleted = true;
+      opt->pendingStore[instr->operand] = index;
+
+      local->id = value->id;
+      local->type = value->type;
+      local->first = -1;
+      value->first = -1;
+      break;
+    }
+    case OP_GET_GLOBAL:
+      // Globals can be changed from anywhere, every read is a new value.
+      pushSlot(opt, freshValue(opt), TYPE_UNKNOWN, -1);
+      break;
+    case OP_DEFINE_GLOBAL:
+      popSlot(opt, true);
+      break;
+    case OP_SET_GLOBAL:
+      if (!hasOperands(opt, 1)) return;
+      top(opt)->first = -1;
+      break;
+    case OP_EQUAL:        binaryValue(opt, index, TYPE_BOOL); break;
+    case OP_GREATER:      numericOp(opt, index, OP_GREATER_NUM, TYPE_BOOL); break;
+    case OP_LESS:         numericOp(opt, index, OP_LESS_NUM, TYPE_BOOL); break;
+    case OP_ADD:          addOp(opt, index); break;
+    case OP_SUBTRACT:     numericOp(opt, index, OP_SUBTRACT_NUM, TYPE_NUMBER); break;
+    case OP_MULTIPLY:     numericOp(opt, index, OP_MULTIPLY_NUM, TYPE_NUMBER); break;
+    case OP_DIVIDE:       numericOp(opt, index, OP_DIVIDE_NUM, TYPE_NUMBER); break;
+    case OP_GREATER_NUM:
+    case OP_LESS_NUM:     binaryValue(opt, index, TYPE_BOOL); break;
+    case OP_ADD_NUM:
+    case OP_SUBTRACT_NUM:
+    case OP_MULTIPLY_NUM:
+    case OP_DIVIDE_NUM:   binaryValue(opt, index, TYPE_NUMBER); break;
+    case OP_NOT: {
+      Slot a = popSlot(opt, true);
+      pushSlot(opt, numberValue(opt, OP_NOT, a.id, 0), TYPE_BOOL, a.first);
+      break;
+    }
+    case OP_NEGATE:
+    case OP_NEGATE_NUM: {
+      if (!hasOperands(opt, 1)) return;
+      if (top(opt)->type == TYPE_NUMBER) instr->op = OP_NEGATE_NUM;
+      Slot a = popSlot(opt, true);
+      pushSlot(opt, numberValue(opt, OP_NEGATE, a.id, 0), TYPE_NUMBER, a.first);
+      refine(opt, a.id, TYPE_NUMBER);
+      break;
+    }
+    case OP_PRINT:
+      popSlot(opt, true);
+      break;
+    case OP_CALL: {
+      // Natives never touch the locals, but what they return is anybody's guess, and clock() doesn't
+      // return the same thing twice, so the result is always a new value.
+      if (!hasOperands(opt, instr->operand + 1)) return;
+      for (int i = 0; i <= instr->operand; i++) popSlot(opt, true);
+      pushSlot(opt, freshValue(opt), TYPE_UNKNOWN, -1);
+      break;
+    }
+    case OP_ARRAY:
+      // Every literal is an array of its own, two of them are never the same value.
+      if (!hasOperands(opt, instr->operand)) return;
+      for (int i = 0; i < instr->operand; i++) popSlot(opt, true);
+      pushSlot(opt, freshValue(opt), TYPE_UNKNOWN, -1);
+      break;
+    case OP_GET_INDEX:
+      // Any store or native can change what's in there since the last read.
+      if (!hasOperands(opt, 2)) return;
+      popSlot(opt, true);
+      popSlot(opt, true);
+      pushSlot(opt, freshValue(opt), TYPE_UNKNOWN, -1);
+      break;
+    case OP_SET_INDEX: {
+      if (!hasOperands(opt, 3)) return;
+      Slot value = popSlot(opt, true);
+      popSlot(opt, true);
+      popSlot(opt, true);
+      pushSlot(opt, value.id, value.type, -1);
+      break;
+    }
+    case OP_JUMP_IF_FALSE:
+      // The condition stays on the stack on both paths.
+      jumpTo(opt, instr->target);
+      startBlock(opt);
+      break;
+    case OP_JUMP:
+    case OP_LOOP:
+      jumpTo(opt, instr->target);
+      break;
+    case OP_RETURN:
+      break;
+  }
+
+  if (produced && !opt->failed) reuseValue(opt, index);
+}
+
+static void analyze(Optimizer* opt) {
+  bool reachable = true; // whether the previous instruction can fall through to this one
+  opt->state.depth = 0;
+  forgetStores(opt);
+
+  for (int i = 0; i < opt->count && !opt->failed; i++) {
+    State* incoming = opt->pending[i];
+
+    if (opt->backTarget[i]) {
+      // A loop header. We don't know what the back edge brings in yet, so every slot is a fresh value.
+      if (!reachable && incoming != NULL) opt->state = *incoming;
+      if (!reachable && incoming == NULL) continue;
+      for (int slot = 0; slot < opt->state.depth; slot++) {
+        opt->state.slots[slot].id = freshValue(opt);
+        opt->state.slots[slot].type = TYPE_UNKNOWN;
+      }
+      startBlock(opt);
+    } else if (incoming != NULL) {
+      if (reachable) mergeStates(opt, incoming, &opt->state);
+      opt->state = *incoming;
+      FREE(State, incoming);
+      opt->pending[i] = NULL;
+      startBlock(opt);
+    } else if (!reachable) {
+      // Dead code nothing jumps to. We leave it exactly as it is.
+      continue;
+    }
+
+    interpretInstr(opt, i);
+    uint8_t op = opt->code[i].op;
+    reachable = op != OP_JUMP && op != OP_LOOP && op != OP_RETURN;
+    if (!reachable) startBlock(opt);
+  }
+}
+
+// ______________ Lowering __________________________
+
+// What an instruction goes back out as. Jumps get their long form here and relaxJumps() takes care of
+// the rest, everything else its compact form if it has one.
+static uint8_t loweredOp(Instr* instr) {
+  if (isJump(instr->op)) return jumpOpcode(instr->op, 4);
+  return compactOpcode(instr->op, instr->operand);
+}
+
+static void writeDistance(Chunk* chunk, int distance, int line) {
+  for (int shift = 24; shift >= 0; shift -= 8) writeChunk(chunk, (distance >> shift) & 0xff, line);
+}
+
+static bool lower(Optimizer* opt) {
+  // A deleted instruction takes no space, so it ends up at the same position as the next live one,
+  // which is exactly where a jump to it should land.
+  int* position = ALLOCATE(int, opt->count + 1);
+  int offset = 0;
+  for (int i = 0; i < opt->count; i++) {
+    Instr* instr = &opt->code[i];
+    position[i] = offset;
+    if (!instr->deleted) offset += instructionLength(loweredOp(instr));
+  }
+  position[opt->count] = offset;
+
+  Chunk lowered;
+  initChunk(&lowered);
+  bool valid = true;
+
+  for (int i = 0; i < opt->count && valid; i++) {
+    Instr* instr = &opt->code[i];
+    if (instr->deleted) continue;
+
+    uint8_t op = loweredOp(instr);
+    int end = position[i] + instructionLength(op);
+    writeChunk(&lowered, op, instr->line);
+    if (instr->op == OP_LOOP) {
+      int jump = end - position[instr->target];
+      if (jump < 0) valid = false;
+      writeChunk(&lowered, (uint8_t)instr->operand, instr->line);
+      writeDistance(&lowered, jump, instr->line);
+    } else if (isJump(instr->op)) {
+      int jump = position[instr->target] - end;
+      if (jump < 0) valid = false;
+      writeDistance(&lowered, jump, instr->line);
+    } else if (operandLength(op) == 1) {
+      writeChunk(&lowered, (uint8_t)instr->operand, instr->line);
+    }
+  }
+
+  FREE_ARRAY(int, position, opt->count + 1);
+  if (!valid) {
+    freeChunk(&lowered);
+    return false;
+  }
+
+  // Swap the new code in, the constant pool stays as it is.
+  Chunk* chunk = opt->chunk;
+  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+  FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+  chunk->count = lowered.count;
+  chunk->capacity = lowered.capacity;
+  chunk->code = lowered.code;
+  chunk->lineCount = lowered.lineCount;
+  chunk->lineCapacity = lowered.lineCapacity;
+  chunk->lines = lowered.lines;
+  freeValueArray(&lowered.constants);
+  relaxJumps(chunk);
+  return true;
+}
+
+void optimizeChunk(Chunk* chunk) {
+  Optimizer opt;
+  opt.chunk = chunk;
+  opt.code = NULL;
+  opt.count = 0;
+  opt.capacity = 0;
+  opt.failed = false;
+  opt.backTarget = NULL;
+  opt.pending = NULL;
+  opt.nextId = CONSTANT_ID(chunk->constants.count);
+  opt.generation = 1;
+
+  opt.keys = NULL;
+  opt.keyCapacity = 0;
+
+  if (lift(&opt)) {
+    // Every instruction adds at most one key, so this keeps the table at most half full.
+    opt.keyCapacity = 16;
+    while (opt.keyCapacity < opt.count * 2) opt.keyCapacity *= 2;
+    opt.keys = ALLOCATE(ValueKey, opt.keyCapacity);
+    memset(opt.keys, 0, sizeof(ValueKey) * opt.keyCapacity);
+
+    analyze(&opt);
+    if (!opt.failed) lower(&opt);
+  }
+
+  if (opt.pending != NULL) {
+    for (int i = 0; i <= opt.count; i++) {
+      if (opt.pending[i] != NULL) FREE(State, opt.pending[i]);
+    }
+    FREE_ARRAY(State*, opt.pending, opt.count + 1);
+    FREE_ARRAY(bool, opt.backTarget, opt.count + 1);
+  }
+  if (opt.code != NULL) FREE_ARRAY(Instr, opt.code, opt.capacity);
+  if (opt.keys != NULL) FREE_ARRAY(ValueKey, opt.keys, opt.keyCapacity);
+}
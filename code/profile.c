@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/profile.h"
+#include "../headers/memory.h"
+#include "../disassembler/debug.h"
+
+// How many of the most frequent opcode pairs make it into the report.
+#define PROFILE_TOP_PAIRS 25
+
+Profile* newProfile(bool timed) {
+  Profile* profile = ALLOCATE(Profile, 1);
+  memset(profile, 0, sizeof(Profile));
+  profile->timed = timed;
+  profile->previous = -1;
+  return profile;
+}
+
+void freeProfile(Profile* profile) {
+  FREE(Profile, profile);
+}
+
+void startProfile(Profile* profile) {
+  profile->previous = -1;
+}
+
+typedef struct {
+  int first;
+  int second; // -1 for a single opcode
+  uint64_t count;
+} ProfileRow;
+
+static int compareRows(const void* a, const void* b) {
+  uint64_t left = ((const ProfileRow*)a)->count;
+  uint64_t right = ((const ProfileRow*)b)->count;
+  return left < right ? 1 : left > right ? -1 : 0;
+}
+
+void printProfile(Profile* profile, FILE* out) {
+  ProfileRow rows[UINT8_COUNT];
+  int rowCount = 0;
+  uint64_t total = 0;
+  uint64_t totalTicks = 0;
+  for (int op = 0; op < UINT8_COUNT; op++) {
+    if (profile->counts[op] == 0) continue;
+    rows[rowCount++] = (ProfileRow){op, -1, profile->counts[op]};
+    total += profile->counts[op];
+    totalTicks += profile->ticks[op];
+  }
+  if (total == 0) return;
+  qsort(rows, rowCount, sizeof(ProfileRow), compareRows);
+
+  fprintf(out, "== opcodes, %llu executed ==\n", (unsigned long long)total);
+  for (int i = 0; i < rowCount; i++) {
+    int op = rows[i].first;
+    fprintf(out, "%-16s %12llu %6.2f%%", opcodeName(op),
+            (unsigned long long)rows[i].count, 100.0 * rows[i].count / total);
+    if (profile->timed) {
+      fprintf(out, "   %14llu " PROFILE_CLOCK " %6.2f%% %8.1f/op", (unsigned long long)profile->ticks[op],
+              totalTicks == 0 ? 0.0 : 100.0 * profile->ticks[op] / totalTicks,
+              (double)profile->ticks[op] / rows[i].count);
+    }
+    fputc('\n', out);
+  }
+
+  // Pairs only exist between opcodes that ran, so there are at most rowCount squared of them.
+  ProfileRow* pairs = malloc(sizeof(ProfileRow) * rowCount * rowCount);
+  int pairCount = 0;
+  uint64_t pairTotal = 0;
+  for (int i = 0; i < rowCount; i++) {
+    for (int j = 0; j < rowCount; j++) {
+      uint64_t count = profile->pairs[rows[i].first][rows[j].first];
+      if (count == 0) continue;
+      pairs[pairCount++] = (ProfileRow){rows[i].first, rows[j].first, count};
+      pairTotal += count;
+    }
+  }
+  qsort(pairs, pairCount, sizeof(ProfileRow), compareRows);
+
+  fprintf(out, "== opcode pairs, top %d of %d ==\n",
+          pairCount < PROFILE_TOP_PAIRS ? pairCount : PROFILE_TOP_PAIRS, pairCount);
+  for (int i = 0; i < pairCount && i < PROFILE_TOP_PAIRS; i++) {
+    fprintf(out, "%-16s -> %-16s %12llu %6.2f%%\n", opcodeName(pairs[i].first), opcodeName(pairs[i].second),
+            (unsigned long long)pairs[i].count, 100.0 * pairs[i].count / pairTotal);
+  }
+  free(pairs);
+}
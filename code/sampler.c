@@ -0,0 +1,120 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "../headers/sampler.h"
+
+// The handler can't allocate, so the counts go into a fixed open addressing table keyed by line.
+// Past this many distinct lines the samples get counted as dropped.
+#define SAMPLER_SLOTS 4096
+
+typedef struct {
+  int line; // 0 for an empty slot, lines start at 1
+  unsigned long count;
+} LineSamples;
+
+static VM* sampledVM;
+static LineSamples lineSamples[SAMPLER_SLOTS];
+static volatile unsigned long total;
+static volatile unsigned long outside; // ticks where the VM wasn't running a chunk, compiling for instance
+static volatile unsigned long dropped;
+
+static void countLine(int line) {
+  unsigned int index = ((unsigned int)line * 2654435761u) & (SAMPLER_SLOTS - 1);
+  for (int probes = 0; probes < SAMPLER_SLOTS; probes++) {
+    LineSamples* slot = &lineSamples[index];
+    if (slot->line == line || slot->line == 0) {
+      slot->line = line;
+      slot->count++;
+      return;
+    }
+    index = (index + 1) & (SAMPLER_SLOTS - 1);
+  }
+  dropped++;
+}
+
+static void handleTick(int signal) {
+  total++;
+  // runChunk() points vm->chunk at the chunk before it sets ip and clears it again before the chunk can be
+  // freed, so a tick either sees a chunk that's still alive or none at all. It can still land between the
+  // two stores, with ip left over from the last chunk, which is what the range check is for.
+  Chunk* chunk = sampledVM->chunk;
+  if (chunk == NULL) {
+    outside++;
+    return;
+  }
+
+  // The ip has usually moved past the opcode already, the instruction that's running is the one before.
+  long offset = (long)(sampledVM->ip - chunk->code) - 1;
+  if (offset < 0) offset = 0;
+  if (offset >= chunk->count) {
+    outside++;
+    return;
+  }
+  countLine(getLine(chunk, (int)offset));
+}
+
+bool startSampler(VM* vm, int frequency) {
+  sampledVM = vm;
+  memset(lineSamples, 0, sizeof(lineSamples));
+  total = outside = dropped = 0;
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = handleTick;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, NULL) < 0) return false;
+
+  long interval = 1000000 / frequency;
+  struct itimerval timer = {{0, interval}, {0, interval}};
+  return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+void stopSampler() {
+  struct itimerval timer = {{0, 0}, {0, 0}};
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+}
+
+static int compareSamples(const void* a, const void* b) {
+  unsigned long left = ((const LineSamples*)a)->count;
+  unsigned long right = ((const LineSamples*)b)->count;
+  if (left != right) return left < right ? 1 : -1;
+  return ((const LineSamples*)a)->line - ((const LineSamples*)b)->line;
+}
+
+// The lines that got any samples, hottest first. Only call once the sampler has stopped.
+static int sortedLines(LineSamples* lines) {
+  int count = 0;
+  for (int i = 0; i < SAMPLER_SLOTS; i++) {
+    if (lineSamples[i].line != 0) lines[count++] = lineSamples[i];
+  }
+  qsort(lines, count, sizeof(LineSamples), compareSamples);
+  return count;
+}
+
+void reportSamples(FILE* out) {
+  LineSamples* lines = malloc(sizeof(LineSamples) * SAMPLER_SLOTS);
+  int count = sortedLines(lines);
+
+  fprintf(out, "== samples, %lu taken ==\n", total);
+  for (int i = 0; i < count; i++) {
+    fprintf(out, "line %-8d %10lu %6.2f%%\n", lines[i].line, lines[i].count, 100.0 * lines[i].count / total);
+  }
+  if (outside > 0) fprintf(out, "%-13s %10lu %6.2f%%\n", "not running", outside, 100.0 * outside / total);
+  if (dropped > 0) fprintf(out, "%-13s %10lu %6.2f%%\n", "dropped", dropped, 100.0 * dropped / total);
+  free(lines);
+}
+
+void writeFoldedSamples(FILE* out, const char* name) {
+  LineSamples* lines = malloc(sizeof(LineSamples) * SAMPLER_SLOTS);
+  int count = sortedLines(lines);
+
+  for (int i = 0; i < count; i++) {
+    fprintf(out, "%s;%s:%d %lu\n", name, name, lines[i].line, lines[i].count);
+  }
+  if (outside > 0) fprintf(out, "%s;[not running] %lu\n", name, outside);
+  free(lines);
+}
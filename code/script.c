@@ -0,0 +1,61 @@
+#include <stdlib.h>
+
+#include "../headers/common.h"
+#include "../headers/script.h"
+#include "../headers/compiler.h"
+#include "../headers/memory.h"
+#include "../headers/object.h"
+#include "../headers/optimizer.h"
+#include "../disassembler/debug.h"
+
+struct Script {
+  Chunk chunk;
+  // The string constants have to live somewhere, so the script keeps a VM of its own that only ever
+  // owns them. Nothing runs on it.
+  VM owner;
+};
+
+Script* compileScript(VM* vm, const char* source, size_t length) {
+  Script* script = ALLOCATE(Script, 1);
+  initVM(&script->owner);
+  script->owner.optimize = vm->optimize;
+  script->owner.sharedStrings = vm->sharedStrings;
+  script->owner.err = vm->err;
+  initChunk(&script->chunk);
+
+  if (!compile(&script->owner, source, length, &script->chunk)) {
+    freeScript(script);
+    return NULL;
+  }
+
+  if (script->owner.optimize) {
+    optimizeChunk(&script->chunk);
+    #ifdef DEBUG_PRINT_CODE
+      disassembleChunk(&script->chunk, "optimized");
+    #endif
+  }
+  return script;
+}
+
+void freeScript(Script* script) {
+  freeChunk(&script->chunk);
+  freeVM(&script->owner);
+  FREE(Script, script);
+}
+
+InterpretResult runScript(VM* vm, const Script* script) {
+  // The bytecode and the line table are shared as they are, but the constants get swapped for the
+  // running VM's own copies of the strings. Strings compare by pointer, so a constant "ab" has to be the
+  // very same object as the "ab" the VM builds out of "a" + "b", and it's the same object the VM's
+  // globals are keyed on. After the first run every one of them is a hit in the VM's intern table.
+  Value constants[UINT8_COUNT];
+  Chunk chunk = script->chunk;
+  for (int i = 0; i < chunk.constants.count; i++) {
+    Value constant = chunk.constants.values[i];
+    constants[i] = IS_STRING(constant) ? OBJ_VAL(adoptString(vm, AS_STRING(constant))) : constant;
+  }
+  chunk.constants.values = constants;
+  chunk.constants.capacity = chunk.constants.count;
+
+  return runChunk(vm, &chunk);
+}
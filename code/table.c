@@ -100,9 +100,8 @@ bool tableSet(Table* table, ObjString* key, Value value) {
   Entry* entry = findEntry(table->entries, table->capacity, key);
   // if that key is empty, means we found a valid place to insert in
   bool isNewKey = entry->key == NULL;
-  // if we hit a tombstone, we assign that as this doesn't affect the count
+  // count includes tombstones, so reusing one doesn't change it and only a truly empty bucket counts
   if (isNewKey && IS_NIL(entry->value)) table->count++;
-  if (isNewKey) table->count++;
 
   entry->key = key;
   entry->value = value;
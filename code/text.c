@@ -0,0 +1,61 @@
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "../headers/text.h"
+
+int findChars(const char* haystack, int length, const char* needle, int needleLength) {
+  if (needleLength == 0) return 0;
+  int last = length - needleLength; // the last place a match could start
+  int i = 0;
+
+#if defined(__SSE2__)
+  // Sixteen starting positions at a time. A position is only worth a memcmp() if both the needle's first
+  // and last characters line up there, which for text rules out nearly all of them.
+  __m128i first = _mm_set1_epi8(needle[0]);
+  __m128i final = _mm_set1_epi8(needle[needleLength - 1]);
+  for (; i + 16 <= last + 1; i += 16) {
+    __m128i starts = _mm_loadu_si128((const __m128i*)(haystack + i));
+    __m128i ends = _mm_loadu_si128((const __m128i*)(haystack + i + needleLength - 1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(starts, first), _mm_cmpeq_epi8(ends, final)));
+    while (mask != 0) {
+      int position = i + __builtin_ctz(mask);
+      if (memcmp(haystack + position, needle, needleLength) == 0) return position;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i <= last; i++) {
+    if (haystack[i] == needle[0] && memcmp(haystack + i, needle, needleLength) == 0) return i;
+  }
+  return -1;
+}
+
+static int orderBytes(char a, char b) {
+  return (unsigned char)a < (unsigned char)b ? -1 : 1;
+}
+
+int compareChars(const char* a, int aLength, const char* b, int bLength) {
+  int shorter = aLength < bLength ? aLength : bLength;
+  int i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 16 <= shorter; i += 16) {
+    __m128i left = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i right = _mm_loadu_si128((const __m128i*)(b + i));
+    int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(left, right));
+    if (equal != 0xffff) {
+      int position = i + __builtin_ctz(~equal);
+      return orderBytes(a[position], b[position]);
+    }
+  }
+#endif
+
+  for (; i < shorter; i++) {
+    if (a[i] != b[i]) return orderBytes(a[i], b[i]);
+  }
+  return aLength < bLength ? -1 : aLength > bLength ? 1 : 0;
+}
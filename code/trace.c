@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/trace.h"
+#include "../headers/memory.h"
+#include "../headers/object.h"
+
+Trace* newTrace(uint32_t capacity) {
+  uint32_t rounded = 1;
+  while (rounded < capacity) rounded <<= 1;
+
+  Trace* trace = ALLOCATE(Trace, 1);
+  trace->events = ALLOCATE(TraceEvent, rounded);
+  trace->capacity = rounded;
+  trace->recorded = 0;
+  trace->chunk = TRACE_NO_CHUNK;
+  trace->chunkCount = 0;
+  trace->chunks = NULL;
+  trace->chunksLength = 0;
+  trace->chunksCapacity = 0;
+  return trace;
+}
+
+void freeTrace(Trace* trace) {
+  FREE_ARRAY(uint8_t, trace->chunks, trace->chunksCapacity);
+  FREE_ARRAY(TraceEvent, trace->events, trace->capacity);
+  FREE(Trace, trace);
+}
+
+static void append(Trace* trace, const void* bytes, size_t length) {
+  if (trace->chunksCapacity < trace->chunksLength + length) {
+    size_t oldCapacity = trace->chunksCapacity;
+    size_t capacity = GROW_CAPACITY(oldCapacity);
+    while (capacity < trace->chunksLength + length) capacity *= 2;
+    trace->chunks = GROW_ARRAY(uint8_t, trace->chunks, oldCapacity, capacity);
+    trace->chunksCapacity = capacity;
+  }
+  memcpy(trace->chunks + trace->chunksLength, bytes, length);
+  trace->chunksLength += length;
+}
+
+static void appendInt(Trace* trace, uint32_t value) {
+  append(trace, &value, sizeof(value));
+}
+
+// Each chunk goes in as its code, its line table and its constants. Constants are a type byte and then
+// the payload, strings as their length and characters, which is all tracedump needs to rebuild them.
+void traceChunk(Trace* trace, Chunk* chunk) {
+  if (trace->chunkCount >= TRACE_NO_CHUNK) {
+    trace->chunk = TRACE_NO_CHUNK;
+    return;
+  }
+  trace->chunk = trace->chunkCount++;
+
+  appendInt(trace, (uint32_t)chunk->count);
+  append(trace, chunk->code, chunk->count);
+  appendInt(trace, (uint32_t)chunk->lineCount);
+  append(trace, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+  appendInt(trace, (uint32_t)chunk->constants.count);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    uint8_t type = (uint8_t)constant.type;
+    append(trace, &type, 1);
+    switch (constant.type) {
+      case VAL_BOOL: append(trace, &AS_BOOL(constant), sizeof(bool)); break;
+      case VAL_NIL: break;
+      case VAL_NUMBER: append(trace, &constant.as.number, sizeof(double)); break;
+      case VAL_INT: append(trace, &AS_INT(constant), sizeof(int64_t)); break;
+      case VAL_OBJ: {
+        ObjString* string = AS_STRING(constant);
+        appendInt(trace, (uint32_t)string->length);
+        append(trace, string->chars, string->length);
+        break;
+      }
+    }
+  }
+}
+
+bool writeTrace(Trace* trace, FILE* out) {
+  uint32_t chunkCount = (uint32_t)trace->chunkCount;
+  uint32_t kept = trace->recorded < trace->capacity ? (uint32_t)trace->recorded : trace->capacity;
+  // Once the ring has wrapped, the oldest event is the one the next would have overwritten.
+  uint32_t oldest = (uint32_t)((trace->recorded - kept) & (trace->capacity - 1));
+  uint32_t firstRun = trace->capacity - oldest < kept ? trace->capacity - oldest : kept;
+
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), out);
+  fwrite(&chunkCount, sizeof(chunkCount), 1, out);
+  fwrite(trace->chunks, 1, trace->chunksLength, out);
+  fwrite(&trace->recorded, sizeof(trace->recorded), 1, out);
+  fwrite(&kept, sizeof(kept), 1, out);
+  fwrite(trace->events + oldest, sizeof(TraceEvent), firstRun, out);
+  fwrite(trace->events, sizeof(TraceEvent), kept - firstRun, out);
+  return !ferror(out);
+}
@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "../headers/memory.h"
+#include "../headers/number.h"
 #include "../headers/object.h"
 #include "../headers/value.h"
 
@@ -28,22 +29,36 @@ void freeValueArray(ValueArray* array) {
 }
 
 void printValue(Value value) {
+  fprintValue(stdout, value);
+}
+
+void fprintValue(FILE* file, Value value) {
   // we unwrap and extract the double value
   switch(value.type) {
     case VAL_BOOL:
-      printf(AS_BOOL(value) ? "true": "false");
+      fputs(AS_BOOL(value) ? "true": "false", file);
       break;
     case VAL_NIL:
-      printf("nil"); break;
-    case VAL_NUMBER:
-      printf("%g", AS_NUMBER(value)); break;
-    case VAL_OBJ: printObject(value); break;
+      fputs("nil", file); break;
+    case VAL_NUMBER: {
+      char buffer[NUMBER_BUFFER_SIZE];
+      fwrite(buffer, 1, formatNumber(AS_NUMBER(value), buffer), file);
+      break;
+    }
+    case VAL_INT: {
+      char buffer[NUMBER_BUFFER_SIZE];
+      fwrite(buffer, 1, formatInt(AS_INT(value), buffer), file);
+      break;
+    }
+    case VAL_OBJ: printObject(file, value); break;
   }
   
 }
 
 bool valuesEqual(Value a, Value b) {
   if (a.type != b.type) {
+    // 1 and 1.0 are the same number.
+    if (IS_NUMBER(a) && IS_NUMBER(b)) return AS_NUMBER(a) == AS_NUMBER(b);
     return false;
   }
 
@@ -51,7 +66,44 @@ bool valuesEqual(Value a, Value b) {
     case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
     case VAL_NIL: return true;
     case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
-    case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
+    case VAL_INT: return AS_INT(a) == AS_INT(b);
+    case VAL_OBJ: {
+      if (AS_OBJ(a) == AS_OBJ(b)) return true;
+      // Interned strings are equal only if they're the same object, but a slice has to be compared by its text.
+      if (!IS_SLICE(a) && !IS_SLICE(b)) return false;
+      if (!isText(a) || !isText(b)) return false;
+      int aLength, bLength;
+      const char* aChars = textChars(a, &aLength);
+      const char* bChars = textChars(b, &bLength);
+      return aLength == bLength && memcmp(aChars, bChars, aLength) == 0;
+    }
     default: return false; // Unreachable
   }
-}
\ No newline at end of file
+}
+
+// Both operands are inside INT_LIMIT, so the sum and the difference can't overflow an int64_t.
+Value addNumber(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) return intResult(AS_INT(a) + AS_INT(b));
+  return NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+}
+
+Value subtractNumber(Value a, Value b) {
+  if (IS_INT(a) && IS_INT(b)) return intResult(AS_INT(a) - AS_INT(b));
+  return NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+}
+
+// A product can overflow, and a zero with a negative on either side is -0, which only a double can be.
+Value multiplyNumber(Value a, Value b) {
+  int64_t product;
+  if (IS_INT(a) && IS_INT(b) && !__builtin_mul_overflow(AS_INT(a), AS_INT(b), &product) &&
+      (product != 0 || (AS_INT(a) >= 0 && AS_INT(b) >= 0))) {
+    return intResult(product);
+  }
+  return NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+}
+
+// -0 is a double too.
+Value negateNumber(Value a) {
+  if (IS_INT(a) && AS_INT(a) != 0) return INT_VAL(-AS_INT(a));
+  return NUMBER_VAL(-AS_NUMBER(a));
+}
@@ -1,59 +1,85 @@
 #include "../headers/common.h"
+#include "../headers/array.h"
 #include "../headers/vm.h"
 #include "../disassembler/debug.h"
 #include "../headers/object.h"
 #include "../headers/memory.h"
 #include "../headers/compiler.h"
+#include "../headers/optimizer.h"
+#include "../headers/jit.h"
+#include "../headers/profile.h"
+#include "../headers/trace.h"
+#include "../headers/loops.h"
+#include "../headers/natives.h"
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 
-VM vm;
-
-static void resetStack() {
-  vm.stackTop = vm.stack; // our top pointer points to the start of the array
+static void resetStack(VM* vm) {
+  vm->stackTop = vm->stack; // our top pointer points to the start of the array
 }
 
-static void runtimeError(const char* format, ...) {
+static void runtimeError(VM* vm, const char* format, ...) {
+  // Whatever the script printed before it went wrong comes out before the error does.
+  flushOutput(vm);
   va_list args;
   va_start(args, format);
-  vfprintf(stderr, format, args);
+  vfprintf(vm->err, format, args);
   va_end(args);
-  fputs("\n", stderr);
+  fputs("\n", vm->err);
+
+  size_t instruction = vm->ip - vm->chunk->code - 1; // the interpreter moves over the bad instruction, hence the -1 to get to the right one
+  int line = getLine(vm->chunk, (int)instruction);
+  fprintf(vm->err, "[line %d] in script\n", line);
+  resetStack(vm);
+}
 
-  size_t instruction = vm.ip - vm.chunk->code - 1; // the interpreter moves over the bad instruction, hence the -1 to get to the right one
-  int line = vm.chunk->lines[instruction];
-  fprintf(stderr, "[line %d] in script\n", line);
-  resetStack();
+void initVM(VM* vm) {
+  vm->chunk = NULL;
+  initTable(&vm->globals);
+  resetStack(vm);
+  vm->objects = NULL;
+  vm->optimize = false;
+  vm->jit = false;
+  vm->sharedStrings = false;
+  vm->profile = NULL;
+  vm->trace = NULL;
+  vm->loops = NULL;
+  memset(vm->backEdges, 0, sizeof(vm->backEdges));
+  vm->out = stdout;
+  vm->err = stderr;
+  initWriter(&vm->output, WRITER_FULL);
+  initTable(&vm->strings);
+  defineNatives(vm);
 }
 
-void initVM() {
-  initTable(&vm.globals);
-  resetStack();
-  vm.objects = NULL;
-  initTable(&vm.strings);
+void freeVM(VM* vm) {
+  flushOutput(vm);
+  freeTable(&vm->globals);
+  freeTable(&vm->strings);
+  freeObjects(vm);
 }
 
-void freeVM() {
-  freeTable(&vm.globals);
-  freeTable(&vm.strings);
-  freeObjects();
+void resetGlobals(VM* vm) {
+  freeTable(&vm->globals);
+  initTable(&vm->globals);
+  defineNatives(vm);
 }
 
-void push(Value value) {
-  *vm.stackTop = value;
-  vm.stackTop++;
+void push(VM* vm, Value value) {
+  *vm->stackTop = value;
+  vm->stackTop++;
 }
 
-Value pop() {
-  vm.stackTop--;
-  return *vm.stackTop;
+Value pop(VM* vm) {
+  vm->stackTop--;
+  return *vm->stackTop;
 }
 
-static Value peek(int distance) {
+static Value peek(VM* vm, int distance) {
   // it returns a Value from the stack but doesn't pop it
   // The distance argument is how far down the top of the stack to look
-  return vm.stackTop[-1 - distance];
+  return vm->stackTop[-1 - distance];
 }
 
 static bool isFalsey(Value value) {
@@ -61,199 +87,98 @@ static bool isFalsey(Value value) {
   return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-  ObjString* b = AS_STRING(pop());
-  ObjString* a = AS_STRING(pop());
+// Shared with the JIT, which calls it once it has checked both operands are strings or slices.
+void concatenate(VM* vm) {
+  int aLength, bLength;
+  const char* bChars = textChars(pop(vm), &bLength);
+  const char* aChars = textChars(pop(vm), &aLength);
 
-  int length = a->length + b->length;
+  int length = aLength + bLength;
   char* chars = ALLOCATE(char, length + 1);
-  memcpy(chars, a->chars, a->length);
-  memcpy(chars + a->length, b->chars, b->length);
+  memcpy(chars, aChars, aLength);
+  memcpy(chars + aLength, bChars, bLength);
   // add null terminator
   chars[length] = '\0';
 
   // actually allocate a new object that the ObjString owns, assume that you can't take ownership of the characters you pass in the source.
-  ObjString* result = takeString(chars, length);
-  push(OBJ_VAL(result));
-}
-
-static InterpretResult run() {
-  #define READ_BYTE() (*vm.ip++)
-  #define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
-  #define READ_STRING()   AS_STRING(READ_CONSTANT());
-  #define READ_SHORT()    (vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | (vm.ip[-1])))
-
-  // Using a do while loop in the macro looks funny, but it gives you a way to contain multiple statements
-  // inside a block that also permits a semicolon at the end.
-  #define BINARY_OP(valueType, op) \
-    do { \
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-        runtimeError("Operands must be numbers."); \
-        return INTERPRET_RUNTIME_ERROR; \
-      }\
-      double b = AS_NUMBER(pop()); \
-      double a = AS_NUMBER(pop()); \
-      push(valueType(a op b)); \
-    } while (false)
-
-
-  for (;;) {
-    #ifdef DEBUG_TRACE_EXECUTION
-
-      printf("        ");
-      for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-        printf("[ ");
-        printValue(*slot);
-        printf(" ]");
-      }
-      printf("\n");
-      disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
-    
-    #endif 
-    uint8_t instruction;
-    // the first read byte always reads the opcode
-    switch(instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        // this modified read byte will provide us with the offset because a constant instruction is 2 bytes.
-        Value constant = READ_CONSTANT();
-        push(constant);
-        break;
-      }
-      case OP_NIL: push(NIL_VAL); break;
-      case OP_TRUE: push(BOOL_VAL(true)); break;
-      case OP_FALSE: push(BOOL_VAL(false)); break;
-      case OP_POP: pop(); break;
-      case OP_GET_LOCAL: {
-        /*
-        It takes a single-byte operand for the stack slot where the local lives. 
-        It loads the value from that index and then pushes it on top of the stack where later instructions can find it.
-        Kind of redudant, since we're popping a value that already is down there in the stack. But that's how stack based bytecode instructions operate.
-        Register based bytecode is better in this aspect that it juggles around the stack, but the instructions are larger and operands are more.
-        */
-        uint8_t slot = READ_BYTE();
-        push(vm.stack[slot]);
-        break;
-      }
-      case OP_SET_LOCAL: {
-        // It takes the assigned value from the top of the stack and stores it in the stack slot corresponding to the local variable
-        uint8_t slot = READ_BYTE();
-        vm.stack[slot] = peek(0);
-        break;
-      }
-      case OP_GET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        Value value;
-        // We pull the constant table index from the instruction’s operand and get the variable name.
-        // Then we use that as a key to look up the variable’s value in the globals hash table.
-        if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(value);
-        break;
-      }
-      case OP_DEFINE_GLOBAL: {
-        ObjString* name = READ_STRING();
-        tableSet(&vm.globals, name, peek(0));
-        pop();
-        break;
-      }
-      case OP_SET_GLOBAL : {
-        ObjString* name = READ_STRING();
-        // if the variable hasn't been defined yet, its a runtime error to try and assign it
-        // Setting a variable doesn't pop the value off the stack. Since assignment is an expression, so it needs to leave that
-        // value there in case the assignment is nested inside some larger expression.
-        if (tableSet(&vm.globals, name, peek(0))) {
-          tableDelete(&vm.globals, name);
-          runtimeError("Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
-        break;
-      }
-      case OP_GREATER: BINARY_OP(NUMBER_VAL, >); break;
-      case OP_LESS: BINARY_OP(NUMBER_VAL, <); break;
-      case OP_ADD: {
-        if ((IS_STRING(peek(0)) && IS_STRING(peek(1)))) {
-          concatenate();
-        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          double b = AS_NUMBER(pop());
-          double a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a+b));
-        } else {
-          runtimeError(
-            "Operands must be two numbers or two strings."
-          );
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
-      }
-      case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-      case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-      case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
-      case OP_NOT: 
-        push(BOOL_VAL(isFalsey(pop())));
-        break;
-      case OP_NEGATE:
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("Operand must be a number.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(-AS_NUMBER(pop()))); 
-      break;
-      case OP_PRINT: {
-        printValue(pop());
-        printf("\n");
-        break;
-      }
-      case OP_JUMP: {
-        uint16_t offset = READ_SHORT();
-
-        // unlike if-else, this jump isn't optional.
-        vm.ip += offset;
-        break;
-      }
-      case OP_JUMP_IF_FALSE: {
-        // get the actual length of the if then block.
-        uint16_t offset = READ_SHORT();
-
-        // if the statement is falsey, jump over it by the offset your compiler calculated.
-        if (isFalsey(peek(0))) vm.ip += offset;
-        break;
-      }
-      case OP_RETURN: {
-        return INTERPRET_OK;
-      }
-    }
-  }
-
-  #undef READ_BYTE
-  #undef READ_CONSTANT
-  #undef READ_STRING
-  #undef READ_SHORT
-  #undef BINARY_OP
+  ObjString* result = takeString(vm, chars, length);
+  push(vm, OBJ_VAL(result));
 }
 
-InterpretResult interpret(const char* source) {
+// The plain loop, what everything runs on unless it asks to be watched.
+#define RUN_NAME run
+#define BEFORE_INSTRUCTION(vm, instruction) ((void)0)
+#include "dispatch.inc"
+#undef RUN_NAME
+#undef BEFORE_INSTRUCTION
+
+// --profile, the same loop counting every instruction as it goes.
+#define RUN_NAME runProfiled
+#define BEFORE_INSTRUCTION(vm, instruction) profileInstruction((vm)->profile, (instruction))
+#include "dispatch.inc"
+#undef RUN_NAME
+#undef BEFORE_INSTRUCTION
+
+// --trace, the same loop recording every instruction into the trace's ring buffer.
+#define RUN_NAME runTraced
+#define BEFORE_INSTRUCTION(vm, instruction) traceInstruction((vm)->trace, (vm), (instruction))
+#include "dispatch.inc"
+#undef RUN_NAME
+#undef BEFORE_INSTRUCTION
+
+InterpretResult interpret(VM* vm, const char* source, size_t length) {
   Chunk chunk;
   initChunk(&chunk);
 
-  if (!compile(source, &chunk)) {
+  if (!compile(vm, source, length, &chunk)) {
     freeChunk(&chunk);
     return INTERPRET_COMPILE_ERROR;
   }
 
-  vm.chunk = &chunk;
-  vm.ip = vm.chunk->code;
-  
-  InterpretResult result = run();
+  if (vm->optimize) {
+    optimizeChunk(&chunk);
+    #ifdef DEBUG_PRINT_CODE
+      disassembleChunk(&chunk, "optimized");
+    #endif
+  }
+
+  InterpretResult result = runChunk(vm, &chunk);
 
   freeChunk(&chunk);
   return result;
 }
 
+InterpretResult runChunk(VM* vm, Chunk* chunk) {
+  vm->chunk = chunk;
+  vm->ip = vm->chunk->code;
+  // Loop numbers only mean something within one chunk.
+  memset(vm->backEdges, 0, sizeof(vm->backEdges));
+
+  InterpretResult result = INTERPRET_OK;
+  JitCode jit;
+  if (vm->profile != NULL) {
+    // Native code would run right past the counters, so a profiled run stays in the interpreter.
+    startProfile(vm->profile);
+    result = runProfiled(vm);
+  } else if (vm->trace != NULL) {
+    // Same for tracing, and the trace needs its own copy of the chunk to make sense of the offsets later.
+    traceChunk(vm->trace, chunk);
+    result = runTraced(vm);
+  } else if (vm->jit && jitCompile(vm, chunk, &jit)) {
+    // Native code runs for as long as it can, then the interpreter picks up at whatever instruction it stopped on.
+    int resume = jit.entry();
+    jitFree(&jit);
+    if (resume != JIT_DONE) {
+      vm->ip = vm->chunk->code + resume;
+      result = run(vm);
+    }
+  } else {
+    result = run(vm);
+  }
+
+  flushOutput(vm);
+  if (vm->loops != NULL) collectLoops(vm->loops, vm, chunk);
+  // The chunk is the caller's to free once we're done, this way the sampler never follows a stale pointer into it.
+  vm->chunk = NULL;
+  return result;
+}
\ No newline at end of file
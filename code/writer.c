@@ -0,0 +1,76 @@
+#include <string.h>
+
+#include "../headers/writer.h"
+#include "../headers/number.h"
+#include "../headers/object.h"
+#include "../headers/vm.h"
+
+void initWriter(Writer* writer, FlushPolicy policy) {
+  writer->length = 0;
+  writer->policy = policy;
+}
+
+// Hands what's buffered to vm.out, without pushing vm.out itself along.
+static void drain(VM* vm) {
+  Writer* writer = &vm->output;
+  if (writer->length == 0) return;
+  fwrite(writer->buffer, 1, writer->length, vm->out);
+  writer->length = 0;
+}
+
+void flushOutput(VM* vm) {
+  // Nothing buffered means nothing to push, and vm.out may already be closed by then.
+  if (vm->output.length == 0) return;
+  drain(vm);
+  fflush(vm->out);
+}
+
+void writeBytes(VM* vm, const char* bytes, size_t length) {
+  Writer* writer = &vm->output;
+  if (writer->length + length > WRITER_BUFFER_SIZE) {
+    drain(vm);
+    // Something that wouldn't fit even in an empty buffer skips it.
+    if (length > WRITER_BUFFER_SIZE) {
+      fwrite(bytes, 1, length, vm->out);
+      return;
+    }
+  }
+  memcpy(writer->buffer + writer->length, bytes, length);
+  writer->length += (int)length;
+}
+
+void writeValue(VM* vm, Value value) {
+  Writer* writer = &vm->output;
+  switch (value.type) {
+    case VAL_BOOL:
+      if (AS_BOOL(value)) writeBytes(vm, "true", 4);
+      else writeBytes(vm, "false", 5);
+      break;
+    case VAL_NIL: writeBytes(vm, "nil", 3); break;
+    case VAL_NUMBER:
+      if (writer->length + NUMBER_BUFFER_SIZE > WRITER_BUFFER_SIZE) drain(vm);
+      writer->length += formatNumber(AS_NUMBER(value), writer->buffer + writer->length);
+      break;
+    case VAL_INT:
+      if (writer->length + NUMBER_BUFFER_SIZE > WRITER_BUFFER_SIZE) drain(vm);
+      writer->length += formatInt(AS_INT(value), writer->buffer + writer->length);
+      break;
+    case VAL_OBJ:
+      if (isText(value)) {
+        int length;
+        const char* chars = textChars(value, &length);
+        writeBytes(vm, chars, length);
+      } else {
+        // Anything without a writer path of its own goes through stdio, behind what's buffered.
+        drain(vm);
+        printObject(vm->out, value);
+      }
+      break;
+  }
+}
+
+void writePrint(VM* vm, Value value) {
+  writeValue(vm, value);
+  writeBytes(vm, "\n", 1);
+  if (vm->output.policy == WRITER_LINE) flushOutput(vm);
+}
@@ -2,6 +2,66 @@
 #include "debug.h"
 #include "../headers/value.h"
 
+// Indexed by opcode, for anything that reports on opcodes without decoding a whole instruction.
+static const char* opcodeNames[UINT8_COUNT] = {
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_NIL] = "OP_NIL",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_POP] = "OP_POP",
+  [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL",
+  [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+  [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+  [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_LESS] = "OP_LESS",
+  [OP_ADD] = "OP_ADD",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_NOT] = "OP_NOT",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_GREATER_NUM] = "OP_GREATER_NUM",
+  [OP_LESS_NUM] = "OP_LESS_NUM",
+  [OP_ADD_NUM] = "OP_ADD_NUM",
+  [OP_SUBTRACT_NUM] = "OP_SUBTRACT_NUM",
+  [OP_MULTIPLY_NUM] = "OP_MULTIPLY_NUM",
+  [OP_DIVIDE_NUM] = "OP_DIVIDE_NUM",
+  [OP_NEGATE_NUM] = "OP_NEGATE_NUM",
+  [OP_PRINT] = "OP_PRINT",
+  [OP_JUMP] = "OP_JUMP",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+  [OP_LOOP] = "OP_LOOP",
+  [OP_CALL] = "OP_CALL",
+  [OP_ARRAY] = "OP_ARRAY",
+  [OP_GET_INDEX] = "OP_GET_INDEX",
+  [OP_SET_INDEX] = "OP_SET_INDEX",
+  [OP_GET_LOCAL_0] = "OP_GET_LOCAL_0",
+  [OP_GET_LOCAL_1] = "OP_GET_LOCAL_1",
+  [OP_GET_LOCAL_2] = "OP_GET_LOCAL_2",
+  [OP_GET_LOCAL_3] = "OP_GET_LOCAL_3",
+  [OP_CONSTANT_0] = "OP_CONSTANT_0",
+  [OP_CONSTANT_1] = "OP_CONSTANT_1",
+  [OP_CONSTANT_2] = "OP_CONSTANT_2",
+  [OP_CONSTANT_3] = "OP_CONSTANT_3",
+  [OP_ZERO] = "OP_ZERO",
+  [OP_ONE] = "OP_ONE",
+  [OP_SMALL_INT] = "OP_SMALL_INT",
+  [OP_JUMP_SHORT] = "OP_JUMP_SHORT",
+  [OP_JUMP_LONG] = "OP_JUMP_LONG",
+  [OP_JUMP_IF_FALSE_SHORT] = "OP_JUMP_IF_FALSE_SHORT",
+  [OP_JUMP_IF_FALSE_LONG] = "OP_JUMP_IF_FALSE_LONG",
+  [OP_LOOP_SHORT] = "OP_LOOP_SHORT",
+  [OP_LOOP_LONG] = "OP_LOOP_LONG",
+  [OP_RETURN] = "OP_RETURN",
+};
+
+const char* opcodeName(uint8_t opcode) {
+  return opcodeNames[opcode] != NULL ? opcodeNames[opcode] : "OP_UNKNOWN";
+}
+
 void disassembleChunk(Chunk* chunk, const char* name) {
   printf("== %s ==\n", name);
 
@@ -19,14 +79,32 @@ static int simpleInstruction(const char* name, int offset) {
 static int byteInstructions(const char* name, Chunk* chunk, int offset) {
   uint8_t slot = chunk->code[offset+1];
   printf("%-16s %4d\n", name, slot);
-  return offset - 2;
+  return offset + 2;
+}
+
+// Every width of jump decodes the same way, jumpTarget() knows where the distance sits.
+static int jumpInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s %4d -> %d\n", name, offset, jumpTarget(chunk, offset));
+  return offset + instructionLength(chunk->code[offset]);
+}
+
+static int loopInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t loop = chunk->code[offset + 1];
+  printf("%-16s %4d -> %d (loop %d)\n", name, offset, jumpTarget(chunk, offset), loop);
+  return offset + instructionLength(chunk->code[offset]);
 }
 
-static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset) {
-  uint16_t jump = (uint16_t)(chunk->code[offset+1] << 8);
-  jump |= chunk->code[offset+2];
-  printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign + jump);
-  return offset + 3;
+// A compact constant has its index in the opcode, but we still show which constant it is.
+static int compactConstantInstruction(const char* name, Chunk* chunk, int offset, int constant) {
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("'\n");
+  return offset + 1;
+}
+
+static int smallIntInstruction(const char* name, Chunk* chunk, int offset) {
+  printf("%-16s %4d\n", name, (int8_t)chunk->code[offset + 1]);
+  return offset + 2;
 }
 
 static int constantInstruction(const char* name, Chunk* chunk, int offset) {
@@ -39,10 +117,11 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset) {
 
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
-  if (offset > 0 && chunk->lines[offset] == chunk->lines[offset-1]) {
+  int line = getLine(chunk, offset);
+  if (offset > 0 && line == getLine(chunk, offset - 1)) {
     printf("   | ");
   }else {
-    printf("%4d ", chunk->lines[offset]);
+    printf("%4d ", line);
   }
   uint8_t instruction = chunk->code[offset];
   switch(instruction) {
@@ -84,12 +163,57 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return simpleInstruction("OP_NOT", offset);
     case OP_NEGATE:
       return simpleInstruction("OP_NEGATE", offset);
+    case OP_GREATER_NUM:
+      return simpleInstruction("OP_GREATER_NUM", offset);
+    case OP_LESS_NUM:
+      return simpleInstruction("OP_LESS_NUM", offset);
+    case OP_ADD_NUM:
+      return simpleInstruction("OP_ADD_NUM", offset);
+    case OP_SUBTRACT_NUM:
+      return simpleInstruction("OP_SUBTRACT_NUM", offset);
+    case OP_MULTIPLY_NUM:
+      return simpleInstruction("OP_MULTIPLY_NUM", offset);
+    case OP_DIVIDE_NUM:
+      return simpleInstruction("OP_DIVIDE_NUM", offset);
+    case OP_NEGATE_NUM:
+      return simpleInstruction("OP_NEGATE_NUM", offset);
     case OP_PRINT:
       return simpleInstruction("OP_PRINT", offset);
+    case OP_JUMP_SHORT:
     case OP_JUMP:
-      return jumpInstruction("OP_JUMP", 1, chunk, offset);
+    case OP_JUMP_LONG:
+    case OP_JUMP_IF_FALSE_SHORT:
     case OP_JUMP_IF_FALSE:
-      return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_FALSE_LONG:
+      return jumpInstruction(opcodeName(instruction), chunk, offset);
+    case OP_LOOP_SHORT:
+    case OP_LOOP:
+    case OP_LOOP_LONG:
+      return loopInstruction(opcodeName(instruction), chunk, offset);
+    case OP_CALL:
+      return byteInstructions("OP_CALL", chunk, offset);
+    case OP_ARRAY:
+      return byteInstructions("OP_ARRAY", chunk, offset);
+    case OP_GET_INDEX:
+      return simpleInstruction("OP_GET_INDEX", offset);
+    case OP_SET_INDEX:
+      return simpleInstruction("OP_SET_INDEX", offset);
+    case OP_GET_LOCAL_0:
+    case OP_GET_LOCAL_1:
+    case OP_GET_LOCAL_2:
+    case OP_GET_LOCAL_3:
+      return simpleInstruction(opcodeName(instruction), offset);
+    case OP_CONSTANT_0:
+    case OP_CONSTANT_1:
+    case OP_CONSTANT_2:
+    case OP_CONSTANT_3:
+      return compactConstantInstruction(opcodeName(instruction), chunk, offset, instruction - OP_CONSTANT_0);
+    case OP_ZERO:
+      return simpleInstruction("OP_ZERO", offset);
+    case OP_ONE:
+      return simpleInstruction("OP_ONE", offset);
+    case OP_SMALL_INT:
+      return smallIntInstruction("OP_SMALL_INT", chunk, offset);
     case OP_RETURN:
       return simpleInstruction("OP_RETURN", offset);
     default:
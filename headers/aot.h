@@ -0,0 +1,79 @@
+#ifndef clox_aot_h
+#define clox_aot_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+
+// Ahead-of-time compilation (--emit-c, --aot). A chunk gets translated into one C function where every
+// instruction is a few lines of straight C, jumps become gotos and the stack is a local array, so the
+// C compiler sees the whole script at once and there's no dispatch left.
+
+// Writes the chunk out as a C translation unit. false if the chunk has an instruction we can't translate.
+bool aotEmit(Chunk* chunk, FILE* out);
+
+// Translates the chunk and runs the system C compiler on it. An output path ending in .so builds a shared
+// object exporting cloxRun(), anything else a standalone executable.
+bool aotCompile(Chunk* chunk, const char* output);
+
+// ______________ Used by the generated code __________________________
+
+// Reports a runtime error the same way the interpreter does and returns INTERPRET_RUNTIME_ERROR.
+InterpretResult aotError(VM* vm, int line, const char* format, ...);
+Value aotString(VM* vm, const char* chars, int length);
+Value aotNumber(uint64_t bits);
+bool aotAdd(VM* vm, Value* a, Value b);
+bool aotCall(VM* vm, Value* args, int argCount, int line);
+Value aotArray(VM* vm, Value* values, int count);
+// OP_GET_INDEX and OP_SET_INDEX on the operands just below sp, the result goes where the array was.
+bool aotGetIndex(VM* vm, Value* sp, int line);
+bool aotSetIndex(VM* vm, Value* sp, int line);
+
+#define AOT_FALSEY(value) (IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+
+#define AOT_NUMBERS(line) \
+  if (!IS_NUMBER(sp[-1]) || !IS_NUMBER(sp[-2])) return aotError(vm, line, "Operands must be numbers.")
+
+// sp[-2] = sp[-2] op sp[-1], the operands are already known to be numbers
+#define AOT_NUMBER_OP(valueType, op) \
+  do { sp[-2] = valueType(AS_NUMBER(sp[-2]) op AS_NUMBER(sp[-1])); sp--; } while (false)
+
+#define AOT_BINARY(valueType, op, line) \
+  do { AOT_NUMBERS(line); AOT_NUMBER_OP(valueType, op); } while (false)
+
+#define AOT_ADD(line) \
+  do { \
+    if (IS_NUMBER(sp[-1]) && IS_NUMBER(sp[-2])) { \
+      AOT_NUMBER_OP(NUMBER_VAL, +); \
+    } else { \
+      if (!aotAdd(vm, &sp[-2], sp[-1])) return aotError(vm, line, "Operands must be two numbers or two strings."); \
+      sp--; \
+    } \
+  } while (false)
+
+#define AOT_NEGATE(line) \
+  do { \
+    if (!IS_NUMBER(sp[-1])) return aotError(vm, line, "Operand must be a number."); \
+    sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1])); \
+  } while (false)
+
+#define AOT_GET_GLOBAL(name, line) \
+  do { \
+    if (!tableGet(&vm->globals, AS_STRING(name), sp)) \
+      return aotError(vm, line, "Undefined variable '%s'.", AS_CSTRING(name)); \
+    sp++; \
+  } while (false)
+
+#define AOT_SET_GLOBAL(name, line) \
+  do { \
+    materialize(vm, &sp[-1]); \
+    if (tableSet(&vm->globals, AS_STRING(name), sp[-1])) { \
+      tableDelete(&vm->globals, AS_STRING(name)); \
+      return aotError(vm, line, "Undefined variable '%s'.", AS_CSTRING(name)); \
+    } \
+  } while (false)
+
+#endif
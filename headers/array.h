@@ -0,0 +1,38 @@
+#ifndef clox_array_h
+#define clox_array_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+// Everything that reads or writes an array goes through here, the interpreter, the JIT helpers, the AOT
+// runtime and the natives alike. The ones that can fail return the message to report, NULL when they didn't.
+
+// An array holding the count values starting at values, kept unboxed if they're all numbers.
+ObjArray* buildArray(VM* vm, Value* values, int count);
+Value arrayElement(ObjArray* array, int index);
+void appendArray(ObjArray* array, Value value);
+// Gets a boxed array holding nothing but numbers back to ARRAY_NUMBERS. false if it has anything else.
+bool unboxArray(ObjArray* array);
+
+// array[index], result can be one of the operands.
+const char* getIndex(Value array, Value index, Value* result);
+// array[index] = value
+const char* setIndex(Value array, Value index, Value value);
+
+// ______________ Bulk operations __________________________
+
+// These run over plain doubles, so they only work on ARRAY_NUMBERS arrays. With SSE2 they do two
+// elements per instruction and keep several sums going at once, which means sum() and dot() add in a
+// different order than a loop in the script would and can differ from it in the last bits.
+double sumNumbers(const double* a, int count);
+double dotNumbers(const double* a, const double* b, int count);
+// a[i] *= k
+void scaleNumbers(double* a, int count, double k);
+// a[i] += b[i]
+void addNumbers(double* a, const double* b, int count);
+// a[i] += x
+void addScalar(double* a, int count, double x);
+
+#endif
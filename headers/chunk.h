@@ -23,22 +23,94 @@ typedef enum {
   OP_DIVIDE,
   OP_NOT,
   OP_NEGATE,
+  // Number specialized forms, only emitted when the compiler has proven both operands are numbers.
+  OP_GREATER_NUM,
+  OP_LESS_NUM,
+  OP_ADD_NUM,
+  OP_SUBTRACT_NUM,
+  OP_MULTIPLY_NUM,
+  OP_DIVIDE_NUM,
+  OP_NEGATE_NUM,
   OP_PRINT,
+  // Forward jumps, the operand is how far past the end of the instruction the target is.
   OP_JUMP,
   OP_JUMP_IF_FALSE,
+  // The backward jump at the bottom of a loop. The first operand numbers the loop within the chunk,
+  // the VM counts how often each one goes around, the rest is how far back the header is.
+  // Every loop from SHARED_LOOP on gets that number and they all count into the one counter.
+  OP_LOOP,
+  // Calls the value under the arguments, the operand is how many there are.
+  OP_CALL,
+  // Builds an array out of the operand's worth of values on top of the stack.
+  OP_ARRAY,
+  // [array, index] -> element and [array, index, value] -> value
+  OP_GET_INDEX,
+  OP_SET_INDEX,
+  // Compact forms with the operand folded into the opcode, the compiler picks them on its own (see
+  // compactOpcode()). Local slots and constant indexes 0 to 3, and small integers.
+  OP_GET_LOCAL_0,
+  OP_GET_LOCAL_1,
+  OP_GET_LOCAL_2,
+  OP_GET_LOCAL_3,
+  OP_CONSTANT_0,
+  OP_CONSTANT_1,
+  OP_CONSTANT_2,
+  OP_CONSTANT_3,
+  OP_ZERO,
+  OP_ONE,
+  // Pushes its operand, a signed byte, as an integer. Never needs a constant.
+  OP_SMALL_INT,
+  // The same three jumps with an 8 and a 32 bit distance, the plain ones have 16 bits. The compiler
+  // emits the long forms and relaxJumps() gives every jump the smallest form its distance fits in.
+  OP_JUMP_SHORT,
+  OP_JUMP_LONG,
+  OP_JUMP_IF_FALSE_SHORT,
+  OP_JUMP_IF_FALSE_LONG,
+  OP_LOOP_SHORT,
+  OP_LOOP_LONG,
   OP_RETURN,
 } OpCODE;
 
+#define SHARED_LOOP UINT8_MAX
+
+// The line table is run-length encoded. Each entry marks the first byte of a run of bytecode
+// that all came from the same source line, so a line costs 8 bytes no matter how much code it compiles to.
+typedef struct {
+  int offset;
+  int line;
+} LineStart;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t* code;
-  int* lines;
+  int lineCount;
+  int lineCapacity;
+  LineStart* lines;
   ValueArray constants;
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
+void truncateChunk(Chunk* chunk, int count);
 int addConstant(Chunk* chunk, Value value);
+int getLine(Chunk* chunk, int offset);
+// The size of an instruction in bytes, opcode included, -1 for a byte that isn't an opcode.
+int instructionLength(uint8_t opcode);
+// The compact opcode for opcode with this operand, or opcode itself when there isn't one.
+uint8_t compactOpcode(uint8_t opcode, int operand);
+// The other way around, the long form a compact opcode stands for and its operand. Anything else comes
+// back unchanged with operand untouched.
+uint8_t expandOpcode(uint8_t opcode, int* operand);
+
+// How many bytes a jump's distance takes, 1, 2 or 4, and 0 for anything that isn't a jump.
+int jumpWidth(uint8_t opcode);
+// The form of the same jump whose distance is width bytes. jumpOpcode(opcode, 2) tells the jumps apart.
+uint8_t jumpOpcode(uint8_t opcode, int width);
+// The offset the jump at offset lands on, whichever form it is.
+int jumpTarget(Chunk* chunk, int offset);
+// Gives every jump in the chunk the smallest form that reaches its target. Shrinking one jump brings
+// others closer, so it goes around until nothing changes.
+void relaxJumps(Chunk* chunk);
 #endif
\ No newline at end of file
@@ -3,6 +3,18 @@
 
 #include "vm.h"
 
-bool compile(const char* source, Chunk* chunk);
+// What the compiler can prove about the value an expression leaves on the stack.
+// When both operands of an arithmetic or comparison operator are known numbers, we emit an _NUM opcode
+// that skips the runtime type checks. Anything we can't prove stays TYPE_UNKNOWN and gets the generic opcode.
+typedef enum {
+  TYPE_UNKNOWN,
+  TYPE_NUMBER,
+  TYPE_BOOL,
+  TYPE_NIL,
+  TYPE_STRING,
+} StaticType;
+
+// Strings the compiler creates are interned in, and owned by, the given VM.
+bool compile(VM* vm, const char* source, size_t length, Chunk* chunk);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef clox_intern_h
+#define clox_intern_h
+
+#include "common.h"
+#include "object.h"
+
+// The optional process-wide intern set. VMs that set sharedStrings intern through here instead of
+// their own vm.strings table, so every interpreter in the process shares one immutable copy of each string.
+// Lookups never take a lock, inserts claim a slot with a compare and swap, and nothing is ever removed,
+// so the strings stay alive until freeSharedStrings().
+
+// Call once, before any VM that uses the set starts. The capacity is rounded up to a power of two.
+void initSharedStrings(int capacity);
+// Only once every VM using the set is gone.
+void freeSharedStrings();
+bool sharedStringsReady();
+
+ObjString* findSharedString(const char* chars, int length, uint32_t hash);
+// Publishes the string and returns it, or the equal string somebody else got in first.
+// NULL means the set is full, the caller keeps the string to itself.
+ObjString* internSharedString(ObjString* string);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef clox_jit_h
+#define clox_jit_h
+
+#include "chunk.h"
+#include "vm.h"
+
+// Native code for one chunk. Calling entry runs the chunk until it either returns or hits something
+// the templates don't handle, and gives back the bytecode offset the interpreter should resume at,
+// or JIT_DONE if the chunk ran all the way to its OP_RETURN.
+#define JIT_DONE -1
+
+typedef int (*JitEntry)();
+
+typedef struct {
+  uint8_t* code;
+  size_t size;
+  JitEntry entry;
+} JitCode;
+
+// The code runs against the given VM only. false when there's no JIT for this platform, or the executable mapping failed
+bool jitCompile(VM* vm, Chunk* chunk, JitCode* jit);
+void jitFree(JitCode* jit);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef clox_loops_h
+#define clox_loops_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "common.h"
+#include "vm.h"
+
+// A loop that goes around at least this many times in one run is hot, the kind worth compiling on its own.
+#define HOT_LOOP_THRESHOLD 1000
+
+// Every OP_LOOP counts its trips in vm->backEdges whatever the VM is doing, that costs one increment per
+// iteration. --loop-stats hangs one of these off the VM so the counts survive past the end of each chunk.
+typedef struct {
+  int line;   // where the loop's header is
+  int loop;   // its number within the chunk
+  uint64_t backEdges;
+  int runs;   // how many chunks it was seen in, the REPL compiles the same line over and over
+} LoopRecord;
+
+typedef struct LoopStats {
+  LoopRecord* records;
+  int count;
+  int capacity;
+} LoopStats;
+
+LoopStats* newLoopStats();
+void freeLoopStats(LoopStats* stats);
+// Adds what every loop in the chunk that just ran did. Called by runChunk() while the chunk is still around.
+void collectLoops(LoopStats* stats, VM* vm, Chunk* chunk);
+// Writes every loop that went around at all, the busiest first, and marks the hot ones.
+void printLoops(LoopStats* stats, FILE* out);
+
+#endif
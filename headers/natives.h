@@ -0,0 +1,13 @@
+#ifndef clox_natives_h
+#define clox_natives_h
+
+#include "vm.h"
+
+// The built-in library: clock(), sqrt(), floor(), min() and max(), plus array(), len(), push() and the
+// bulk array operations sum(), dot(), scale() and mapAdd(), and the string natives slice(), find(), contains(),
+// split() and compare(). The natives themselves are static
+// objects every VM shares, this only binds their names in the VM's globals, which initVM() and
+// resetGlobals() do for you.
+void defineNatives(VM* vm);
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef clox_number_h
+#define clox_number_h
+
+#include "common.h"
+
+// Big enough for any double formatNumber() writes, sign, 17 digits, point, exponent and the terminator.
+#define NUMBER_BUFFER_SIZE 32
+
+// Writes the shortest decimal string that reads back as exactly the same double and returns its length.
+// Integers come out the way you'd write them, without a fraction or exponent, and so does everything else
+// until its decimal exponent drops below -4 or reaches 21, then it's scientific like %g, 1e+21 or 1.5e-07.
+// Unlike printf() there's no locale involved, the point is always a point.
+int formatNumber(double value, char* buffer);
+// The same for a VAL_INT, which is always an integer, so it's just the digits.
+int formatInt(int64_t value, char* buffer);
+
+#endif
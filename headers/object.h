@@ -7,6 +7,12 @@
 #define OBJ_TYPE(value)       (AS_OBJ(value)->type)
 
 #define IS_STRING(value)      isObjType(value, OBJ_STRING)
+#define IS_NATIVE(value)      isObjType(value, OBJ_NATIVE)
+#define AS_NATIVE(value)      ((ObjNative*)AS_OBJ(value))
+#define IS_ARRAY(value)       isObjType(value, OBJ_ARRAY)
+#define AS_ARRAY(value)       ((ObjArray*)AS_OBJ(value))
+#define IS_SLICE(value)       isObjType(value, OBJ_SLICE)
+#define AS_SLICE(value)       ((ObjSlice*)AS_OBJ(value))
 
 // down-casting Obj* to a VALID ObjString 
 #define AS_STRING(value)      ((ObjString*)AS_OBJ(value))
@@ -17,6 +23,9 @@
 
 typedef enum {
   OBJ_STRING,
+  OBJ_NATIVE,
+  OBJ_ARRAY,
+  OBJ_SLICE,
 } ObjType;
 
 struct Obj {
@@ -31,11 +40,65 @@ struct ObjString {
   uint32_t hash;
 };
 
-ObjString* takeString(char* chars, int length);
+// A function written in C. Its arguments are a window of the VM's stack, args[0] to args[argCount - 1],
+// so calling one copies nothing, and it leaves its result in args[-1], the slot it was called from.
+// Returns NULL when it worked, otherwise the message for the runtime error.
+typedef const char* (*NativeFn)(VM* vm, int argCount, Value* args);
 
-ObjString* copyString(const char* chars, int length);
+typedef struct {
+  Obj obj;
+  NativeFn function;
+  int arity; // -1 for natives that check the argument count themselves
+  const char* name;
+} ObjNative;
+
+// An array keeps its elements as bare doubles for as long as it only holds numbers, which is what lets the
+// bulk operations in array.h run over them with SIMD. The first thing stored that isn't a number switches
+// it over to boxed Values for good, or until a bulk operation finds nothing but numbers in it again.
+typedef enum {
+  ARRAY_NUMBERS,
+  ARRAY_VALUES,
+} ArrayKind;
+
+typedef struct {
+  Obj obj;
+  ArrayKind kind;
+  int count;
+  int capacity;
+  union {
+    double* numbers;
+    Value* values;
+  } as;
+} ObjArray;
+
+// A run of another string's characters, made without copying them. The characters aren't null terminated
+// and a slice isn't interned, so two slices with the same text are different objects, valuesEqual() compares
+// them by content. Slices always point into a real string, never into another slice.
+typedef struct {
+  Obj obj;
+  ObjString* owner;
+  const char* chars;
+  int length;
+} ObjSlice;
+
+// Both intern the string in the given VM, which owns the object from then on.
+ObjString* takeString(VM* vm, char* chars, int length);
+
+ObjString* copyString(VM* vm, const char* chars, int length);
 
-void printObject(Value value);
+// The string this VM has interned with the same characters as one owned by somebody else, copying it in
+// if there isn't one yet. The other string is only read, so whoever owns it can be on another thread.
+ObjString* adoptString(VM* vm, const ObjString* string);
+
+// A new array of count elements, zeros for numbers, nil for values.
+ObjArray* newArray(VM* vm, ArrayKind kind, int count);
+
+// length characters of owner starting at start. Slicing the whole string just hands back owner.
+Value newSlice(VM* vm, ObjString* owner, int start, int length);
+// The interned string with the slice's characters.
+ObjString* materializeSlice(VM* vm, ObjSlice* slice);
+
+void printObject(FILE* file, Value value);
 
 // Why not just place this in the macro itself?
 // Macros evaluate the passed expressions as many times as they appear in the code,
@@ -44,4 +107,24 @@ static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && (AS_OBJ(value)->type == type);
 }
 
+// Strings and slices read the same way, as length characters starting at chars.
+static inline bool isText(Value value) {
+  return IS_OBJ(value) && (AS_OBJ(value)->type == OBJ_STRING || AS_OBJ(value)->type == OBJ_SLICE);
+}
+
+static inline const char* textChars(Value text, int* length) {
+  if (IS_SLICE(text)) {
+    *length = AS_SLICE(text)->length;
+    return AS_SLICE(text)->chars;
+  }
+  *length = AS_STRING(text)->length;
+  return AS_STRING(text)->chars;
+}
+
+// Globals outlive the code that stored them, and embedders read them back expecting ObjStrings, so a slice
+// on its way into one gets swapped for the interned string first.
+static inline void materialize(VM* vm, Value* value) {
+  if (IS_SLICE(*value)) *value = OBJ_VAL(materializeSlice(vm, AS_SLICE(*value)));
+}
+
 #endif 
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef clox_optimizer_h
+#define clox_optimizer_h
+
+#include "chunk.h"
+
+// The optional optimizing tier (-O). It lifts a finished chunk into SSA form, cleans it up
+// and lowers it back into ordinary bytecode, so the VM never knows it happened.
+void optimizeChunk(Chunk* chunk);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef clox_profile_h
+#define clox_profile_h
+
+#include <stdio.h>
+
+#include "common.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_CLOCK "cycles"
+#else
+#include <time.h>
+#define PROFILE_CLOCK "ns"
+#endif
+
+// Execution counts for --profile. Setting vm.profile switches the VM over to a second copy of the
+// dispatch loop that calls profileInstruction() before every instruction, the plain loop never looks.
+// Counts are per opcode and per pair of consecutive opcodes, which is what tells you whether a
+// superinstruction or a specialized form would pay for itself.
+typedef struct Profile {
+  bool timed;     // also charge every opcode the clock ticks until the next one starts (--profile=cycles)
+  int previous;   // the opcode that ran last, -1 at the start of a chunk
+  uint64_t started;
+  uint64_t counts[UINT8_COUNT];
+  uint64_t ticks[UINT8_COUNT];
+  uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+} Profile;
+
+// Profiles are half a megabyte, mostly the pair matrix, so they live on the heap.
+Profile* newProfile(bool timed);
+void freeProfile(Profile* profile);
+// Called when a chunk starts, so the last instruction of one run doesn't pair up with the first of the next.
+void startProfile(Profile* profile);
+// Writes the histograms, most frequent first.
+void printProfile(Profile* profile, FILE* out);
+
+static inline uint64_t profileClock() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+#endif
+}
+
+static inline void profileInstruction(Profile* profile, uint8_t instruction) {
+  profile->counts[instruction]++;
+  if (profile->previous >= 0) profile->pairs[profile->previous][instruction]++;
+
+  if (profile->timed) {
+    // The time between two instructions starting goes to the first one. It includes the counting
+    // above, so only compare the numbers with each other, not with an unprofiled run.
+    uint64_t now = profileClock();
+    if (profile->previous >= 0) profile->ticks[profile->previous] += now - profile->started;
+    profile->started = now;
+  }
+  profile->previous = instruction;
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef clox_sampler_h
+#define clox_sampler_h
+
+#include <stdio.h>
+
+#include "vm.h"
+
+// The sampling profiler (--sample). A SIGPROF interval timer interrupts the process every so often and
+// the handler looks at where the VM's ip is, maps it through the chunk's line table and counts a hit for
+// that line. Nothing happens between ticks, so it's cheap enough to leave on.
+// There's one timer per process, so only one VM at a time can be sampled.
+
+// Ticks per second of CPU time. Not a round number, so the ticks don't fall into step with a loop.
+#define SAMPLER_FREQUENCY 997
+
+// false if the timer or the handler can't be installed.
+bool startSampler(VM* vm, int frequency);
+void stopSampler();
+
+// Samples per source line, hottest first.
+void reportSamples(FILE* out);
+// The same counts as folded stacks, one "name;name:line count" per line, for flamegraph.pl and friends.
+// Lox has no functions yet, so every stack is the script and a line in it.
+void writeFoldedSamples(FILE* out, const char* name);
+
+#endif
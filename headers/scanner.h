@@ -1,10 +1,13 @@
 #ifndef clox_scanner_h
 #define clox_scanner_h
 
+#include <stddef.h>
+
 typedef enum {
   // Single-character Tokens.
   TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
   TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+  TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
   TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
   TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
 
@@ -33,6 +36,14 @@ typedef struct {
   int line;
 } Token;
 
-void initScanner(const char* source);
-Token scanToken();
+// All the scanner's state lives in here, so any number of them can be scanning at once.
+typedef struct {
+  const char* start; // the start of the current lexeme. ex: for var, it'd be 'v'
+  const char* current; // the current character of the lexeme we're on. ex: for var, it could be 'a'
+  const char* end; // one past the last character of the source, the buffer doesn't need a null terminator
+  int line; // tracks the line number of current lexeme to help with error reporting
+} Scanner;
+
+void initScanner(Scanner* scanner, const char* source, size_t length);
+Token scanToken(Scanner* scanner);
 #endif 
\ No newline at end of file
@@ -0,0 +1,21 @@
+#ifndef clox_script_h
+#define clox_script_h
+
+#include "vm.h"
+
+// Compile once, run many times. A Script is a compiled chunk that nothing writes to once compileScript()
+// returns, so any number of VMs on any number of threads can run the same one at the same time, and
+// running it again never goes back through the scanner or the compiler.
+typedef struct Script Script;
+
+// Compiles with the given VM's settings (-O, shared strings) and reports errors to its err stream,
+// but the VM itself isn't touched. NULL on a compile error.
+Script* compileScript(VM* vm, const char* source, size_t length);
+// Only once nobody is running it anymore.
+void freeScript(Script* script);
+
+// Runs the script against whatever globals the VM already has, so state carries over from one run to
+// the next. Call resetGlobals() first for a clean slate.
+InterpretResult runScript(VM* vm, const Script* script);
+
+#endif
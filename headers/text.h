@@ -0,0 +1,15 @@
+#ifndef clox_text_h
+#define clox_text_h
+
+#include "common.h"
+
+// Searching and comparing runs of characters, what the string natives are built on. They take plain
+// pointers and lengths so strings and slices go through them alike, see textChars() in object.h.
+// With SSE2 they look at 16 bytes per instruction.
+
+// Where needle first shows up in haystack, -1 if it doesn't. An empty needle is found right away.
+int findChars(const char* haystack, int length, const char* needle, int needleLength);
+// Byte by byte like memcmp(), with a string that runs out first ordering before the longer one. -1, 0 or 1.
+int compareChars(const char* a, int aLength, const char* b, int bLength);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef clox_trace_h
+#define clox_trace_h
+
+#include <stdio.h>
+
+#include "chunk.h"
+#include "vm.h"
+
+// Binary execution tracing (--trace). With vm.trace set, runChunk() switches to a third copy of the dispatch
+// loop that drops an 8 byte event into a ring buffer before every instruction, so a trace costs a store or
+// two per instruction instead of a printf, and the plain loop doesn't know tracing exists. Only the most
+// recent events survive, which is usually the part you want: what led up to the crash or the wrong answer.
+// Set or clear vm.trace between runs to switch it on and off.
+//
+// The events only carry offsets, so the trace also keeps a copy of every chunk it saw. tracedump
+// (tools/tracedump.c) reads the file back and decodes the events with disassembleInstruction().
+
+// What was on top of the stack when there wasn't anything.
+#define TRACE_EMPTY_STACK 0xff
+// Chunks past this many still get traced, their events just can't be decoded.
+#define TRACE_NO_CHUNK 0xffff
+
+typedef struct {
+  uint32_t offset;
+  uint16_t chunk;  // which of the trace's chunks, in the order they ran
+  uint8_t opcode;
+  uint8_t top;     // the ValueType on top of the stack before the instruction ran, or TRACE_EMPTY_STACK
+} TraceEvent;
+
+typedef struct Trace {
+  TraceEvent* events;
+  uint32_t capacity;  // a power of two, so wrapping around is a mask
+  uint64_t recorded;  // every event ever, the ring holds the last capacity of them
+  int chunk;          // the chunk currently running
+  int chunkCount;
+  // Every chunk serialized as it started running, since the chunk itself is gone by the time the trace is written.
+  uint8_t* chunks;
+  size_t chunksLength;
+  size_t chunksCapacity;
+} Trace;
+
+// The file starts with this, followed by the chunk count and the chunks, then the number of events ever
+// recorded, the number kept and the kept events oldest first. Everything is in the host's byte order.
+#define TRACE_MAGIC "CLOXTRC2"
+
+// Keeps the last capacity events, rounded up to a power of two.
+Trace* newTrace(uint32_t capacity);
+void freeTrace(Trace* trace);
+// Called by runChunk() as a traced chunk starts.
+void traceChunk(Trace* trace, Chunk* chunk);
+bool writeTrace(Trace* trace, FILE* out);
+
+static inline void traceInstruction(Trace* trace, VM* vm, uint8_t instruction) {
+  TraceEvent* event = &trace->events[trace->recorded++ & (trace->capacity - 1)];
+  // READ_BYTE() has already moved past the opcode
+  event->offset = (uint32_t)(vm->ip - vm->chunk->code - 1);
+  event->chunk = (uint16_t)trace->chunk;
+  event->opcode = instruction;
+  event->top = vm->stackTop == vm->stack ? TRACE_EMPTY_STACK : (uint8_t)vm->stackTop[-1].type;
+}
+
+#endif
@@ -1,23 +1,34 @@
 #ifndef clox_value_h
 #define clox_value_h
 
+#include <stdio.h>
+
 #include "common.h"
             // Name   Alias, syntax error if Alias is not declared
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
+typedef struct VM VM;
 
+// A number is a VAL_NUMBER double or a VAL_INT integer, scripts can't tell which one they have. Integers
+// only stay integers while they're inside INT_LIMIT, where every one of them is exact as a double too, so
+// integer arithmetic always lands on the same number double arithmetic would have. Anything outside it, and
+// anything that has to be -0, goes back to being a double.
 typedef enum {
   VAL_BOOL,
   VAL_NIL,
   VAL_NUMBER,
+  VAL_INT,
   VAL_OBJ
 } ValueType;
 
+#define INT_LIMIT 9007199254740992LL // 2^53
+
 typedef struct {
   ValueType type;
   union {
     bool boolean;
     double number;
+    int64_t integer;
     Obj* obj;
   } as;
 } Value;
@@ -26,13 +37,16 @@ typedef struct {
 // Any time we call a AS_ macro, we need to use these IS_ macros as guards 
 #define IS_BOOL(value)      ((value).type == VAL_BOOL)
 #define IS_NIL(value)       ((value).type == VAL_NIL)
-#define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
+#define IS_NUMBER(value)    ((value).type == VAL_NUMBER || (value).type == VAL_INT)
+#define IS_INT(value)       ((value).type == VAL_INT)
 #define IS_OBJ(value)       ((value).type == VAL_OBJ)
 
 // It's not safe to use any of the AS_ macros unless we know the value contains the appropriate type.
 #define AS_OBJ(value)       ((value).as.obj)
 #define AS_BOOL(value)      ((value).as.boolean)
-#define AS_NUMBER(value)    ((value).as.number)
+// Either kind of number as a double. It looks at value twice, so don't hand it anything with side effects.
+#define AS_NUMBER(value)    ((value).type == VAL_INT ? (double)(value).as.integer : (value).as.number)
+#define AS_INT(value)       ((value).as.integer)
 
 #define BOOL_VAL(value)         ((Value){VAL_BOOL, {.boolean = value}})
 /*
@@ -44,6 +58,14 @@ typedef struct {
 #define NIL_VAL                 ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value)       ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object)         ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+#define INT_VAL(value)          ((Value){VAL_INT, {.integer = value}})
+
+// An exact integer result, kept as an integer if it's still inside INT_LIMIT. Outside it the conversion
+// rounds the same way the double operation would have.
+static inline Value intResult(int64_t value) {
+  if (value > INT_LIMIT || value < -INT_LIMIT) return NUMBER_VAL((double)value);
+  return INT_VAL(value);
+}
 
 typedef struct {
   int capacity;
@@ -52,9 +74,16 @@ typedef struct {
 } ValueArray;
 
 bool valuesEqual(Value a, Value b);
+// Number arithmetic on operands already known to be numbers, integers where both are and the result fits.
+Value addNumber(Value a, Value b);
+Value subtractNumber(Value a, Value b);
+Value multiplyNumber(Value a, Value b);
+Value negateNumber(Value a);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
 void printValue(Value value);
+// The same, but to any stream. The VM prints through this so each interpreter can have its own output.
+void fprintValue(FILE* file, Value value);
 
 #endif
\ No newline at end of file
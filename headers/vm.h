@@ -1,12 +1,16 @@
 #ifndef clox_vm_h
 #define clox_vm_h
+#include <stdio.h>
+
 #include "value.h"
 #include "chunk.h"
 #include "table.h"
+#include "writer.h"
 
 #define STACK_MAX 256
 
-typedef struct {
+// Everything one interpreter needs. Nothing is shared between VMs, so separate ones can run on separate threads.
+typedef struct VM {
   Chunk* chunk;
   /*We use an actual real C pointer pointing right into the middle of the bytecode array instead of something like an integer index
    because it’s faster to dereference a pointer than look up an element in an array by index.*/
@@ -17,6 +21,16 @@ typedef struct {
   Table globals;
   Table strings;
   Obj* objects;
+  bool optimize; // run the optimizing tier (-O) over every chunk before executing it
+  bool jit;      // run chunks as native code from the template JIT (--jit) where the platform has one
+  bool sharedStrings; // intern strings in the process-wide set (intern.h) instead of our own table
+  struct Profile* profile; // opcode counters for --profile, NULL runs the plain dispatch loop
+  struct Trace* trace;     // the ring buffer for --trace, NULL when not tracing
+  struct LoopStats* loops; // back-edge totals for --loop-stats, NULL when nobody is asking
+  uint64_t backEdges[UINT8_COUNT]; // how often each loop in the running chunk has gone around, by loop number
+  FILE* out;     // where print goes, stdout unless whoever owns the VM says otherwise
+  Writer output; // what print has written that hasn't reached out yet
+  FILE* err;     // where compile and runtime errors go, stderr by default
 } VM;
 
 typedef enum {
@@ -25,11 +39,13 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-extern VM vm;
-
-void initVM();
-void freeVM();
-InterpretResult interpret(const char* source);
-void push(Value value);
-Value pop();
+void initVM(VM* vm);
+void freeVM(VM* vm);
+InterpretResult interpret(VM* vm, const char* source, size_t length);
+InterpretResult runChunk(VM* vm, Chunk* chunk);
+// Forgets every global but the built-ins, so the next script runs as if the VM were new. Interned strings stay.
+void resetGlobals(VM* vm);
+void concatenate(VM* vm);
+void push(VM* vm, Value value);
+Value pop(VM* vm);
 #endif 
\ No newline at end of file
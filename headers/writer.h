@@ -0,0 +1,33 @@
+#ifndef clox_writer_h
+#define clox_writer_h
+
+#include "common.h"
+#include "value.h"
+
+// The VM's own output buffer. print goes in here instead of straight to stdio, strings are copied by the
+// length they already know and numbers are formatted right into the buffer, and the whole lot reaches
+// vm.out in one big fwrite() whenever the buffer fills up or the policy says so.
+// runChunk() flushes when the chunk is done, runtime errors flush before they report, and so does freeVM(),
+// so nothing printed is ever lost or ends up behind the error it led to.
+
+#define WRITER_BUFFER_SIZE 8192
+
+typedef enum {
+  WRITER_FULL, // only when the buffer is full or the chunk is done, for scripts
+  WRITER_LINE, // after every print as well, for the REPL
+} FlushPolicy;
+
+typedef struct {
+  char buffer[WRITER_BUFFER_SIZE];
+  int length;
+  FlushPolicy policy;
+} Writer;
+
+void initWriter(Writer* writer, FlushPolicy policy);
+void writeBytes(VM* vm, const char* bytes, size_t length);
+void writeValue(VM* vm, Value value);
+// What OP_PRINT does, the value and a newline.
+void writePrint(VM* vm, Value value);
+void flushOutput(VM* vm);
+
+#endif
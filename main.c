@@ -1,13 +1,51 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "./headers/common.h"
 #include "./headers/chunk.h"
 #include "./disassembler/debug.h"
 #include "./headers/vm.h"
+#include "./headers/compiler.h"
+#include "./headers/optimizer.h"
+#include "./headers/aot.h"
+#include "./headers/intern.h"
+#include "./headers/profile.h"
+#include "./headers/sampler.h"
+#include "./headers/trace.h"
+#include "./headers/loops.h"
 
-static void repl() {
+// Room for this many distinct strings across every VM before they start falling back to their own tables.
+#define SHARED_STRINGS_CAPACITY (1 << 16)
+// --trace keeps this many of the most recent instructions, half a megabyte of events.
+#define TRACE_CAPACITY (1 << 16)
+
+// Where --trace writes the ring buffer once the script is done.
+static const char* tracePath = NULL;
+
+// Whatever the run was instrumented with gets reported here, whether the script finished or not.
+static void reportRun(VM* vm) {
+  if (vm->profile != NULL) printProfile(vm->profile, stderr);
+  if (vm->loops != NULL) printLoops(vm->loops, stderr);
+  if (vm->trace != NULL) {
+    FILE* file = fopen(tracePath, "wb");
+    if (file == NULL || !writeTrace(vm->trace, file)) {
+      fprintf(stderr, "Could not write trace \"%s\".\n", tracePath);
+    }
+    if (file != NULL) fclose(file);
+  }
+}
+
+static void repl(VM* vm) {
+  // Each print shows up as soon as it runs, not when the line is done.
+  vm->output.policy = WRITER_LINE;
   char line[1024];
   for (;;) {
     printf("> ");
@@ -17,68 +55,549 @@ static void repl() {
       break;
     }
 
-    interpret(line);
+    interpret(vm, line, strlen(line));
   }
+  reportRun(vm);
 }
 
-static char* readFile(const char* path) {
-  // read file in binary mode
-  FILE* file = fopen(path, "rb");
+typedef struct {
+  const char* chars;
+  size_t length;
+  // mapped sources have to go back with munmap(), streamed ones with free()
+  bool mapped;
+} Source;
 
-  if (file == NULL) {
-    fprintf(stderr, "Could not open file \"%s\".\n", path);
+#define STREAM_BLOCK_SIZE (64 * 1024)
+
+static void* allocateSource(void* buffer, size_t size, const char* path) {
+  void* result = realloc(buffer, size);
+  if (result == NULL) {
+    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
     exit(74);
   }
-  
-  // seek to end of file to get the size of the file
-  fseek(file, 0L, SEEK_END);
-  size_t fileSize = ftell(file);
-  // return to the start again
-  rewind(file);
+  return result;
+}
 
-  // now read the file into a string buffer
-  char* buffer = (char*)malloc(fileSize + 1); // +1 to make size for the null terminator
+// Pipes and terminals can't be mapped or seeked, so we pull them in block by block until EOF.
+static Source streamSource(int fd, const char* path) {
+  size_t capacity = STREAM_BLOCK_SIZE;
+  size_t length = 0;
+  char* buffer = allocateSource(NULL, capacity, path);
 
-  if (buffer == NULL) {
-    fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-    exit(74);
+  for (;;) {
+    if (capacity - length < STREAM_BLOCK_SIZE) {
+      capacity *= 2;
+      buffer = allocateSource(buffer, capacity, path);
+    }
+
+    ssize_t bytesRead = read(fd, buffer + length, capacity - length);
+    if (bytesRead == 0) break;
+    if (bytesRead < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "Could not read file \"%s\".\n", path);
+      exit(74);
+    }
+    length += (size_t)bytesRead;
+  }
+
+  return (Source){buffer, length, false};
+}
+
+// Reports a file we can't open to err and returns false, so batch mode can carry on with the other scripts.
+static bool loadSource(const char* path, Source* result, FILE* err) {
+  // "-" means the script comes in through stdin
+  if (strcmp(path, "-") == 0) {
+    *result = streamSource(STDIN_FILENO, path);
+    return true;
+  }
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(err, "Could not open file \"%s\".\n", path);
+    return false;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    fprintf(err, "Could not read file \"%s\".\n", path);
+    close(fd);
+    return false;
+  }
+
+  Source source;
+  if (!S_ISREG(info.st_mode)) {
+    source = streamSource(fd, path);
+  } else if (info.st_size == 0) {
+    // mmap() refuses zero length mappings, but an empty script is still a valid script.
+    source = (Source){NULL, 0, false};
+  } else {
+    // Mapping the file means the kernel pages the source in as the scanner walks over it,
+    // and clean pages can be dropped again instead of us holding a private copy of the whole thing.
+    void* mapping = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+      source = streamSource(fd, path);
+    } else {
+      madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+      source = (Source){mapping, (size_t)info.st_size, true};
+    }
   }
-  // kisme read, kitna bytes ka step lena, total kitne bytes read krne, kaunsi file se read krne
-  size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-  if (bytesRead < fileSize) {
-    fprintf(stderr, "Could not read file \"%s\".\n", path);
+
+  close(fd);
+  *result = source;
+  return true;
+}
+
+static Source readSource(const char* path) {
+  Source source;
+  if (!loadSource(path, &source, stderr)) exit(74);
+  return source;
+}
+
+static void freeSource(Source* source) {
+  if (source->mapped) {
+    munmap((void*)source->chars, source->length);
+  } else {
+    free((void*)source->chars);
   }
-  // mark EOF with a null character
-  buffer[bytesRead] = '\0';
-  fclose(file);
-  return buffer;
 }
 
-static void runFile(const char* path) {
-  char* source = readFile(path);
-  InterpretResult result = interpret(source);
-  free(source);
+static void runFile(VM* vm, const char* path) {
+  Source source = readSource(path);
+  InterpretResult result = interpret(vm, source.chars, source.length);
+  freeSource(&source);
+  // A script that died halfway is still worth a profile or a trace, so this comes before the exit.
+  reportRun(vm);
 
   if (result == INTERPRET_COMPILE_ERROR) exit(65);
   if (result == INTERPRET_RUNTIME_ERROR) exit(70);
 }
 
-int main(int argc, const char* argv[]) {
-  initVM();
+// --sample runs the script (or the REPL) with the sampling profiler on, writes the folded stacks to
+// foldedPath and the per-line counts to stderr. Errors in the script still get their report.
+static void sampleFile(VM* vm, const char* path, const char* foldedPath) {
+  FILE* folded = fopen(foldedPath, "w");
+  if (folded == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", foldedPath);
+    exit(74);
+  }
+  if (!startSampler(vm, SAMPLER_FREQUENCY)) {
+    fprintf(stderr, "Could not start the sampling profiler.\n");
+    exit(70);
+  }
+
+  InterpretResult result = INTERPRET_OK;
+  if (path == NULL) {
+    repl(vm);
+  } else {
+    Source source = readSource(path);
+    result = interpret(vm, source.chars, source.length);
+    freeSource(&source);
+  }
+
+  stopSampler();
+  // the REPL reports on its own
+  if (path != NULL) reportRun(vm);
+  reportSamples(stderr);
+  writeFoldedSamples(folded, path == NULL ? "repl" : path);
+  fclose(folded);
+
+  if (result == INTERPRET_COMPILE_ERROR) exit(65);
+  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+// Runs the source once and returns everything it printed, stdout goes to a temporary file for the duration.
+static char* captureRun(const Source* source, bool optimize, bool jit, InterpretResult* result, size_t* length) {
+  fflush(stdout);
+  FILE* capture = tmpfile();
+  if (capture == NULL) {
+    fprintf(stderr, "Could not create a temporary file for --jit-diff.\n");
+    exit(74);
+  }
+  int saved = dup(STDOUT_FILENO);
+  dup2(fileno(capture), STDOUT_FILENO);
 
-  if (argc == 1) {
-    repl();
-  }else if (argc == 2) {
-    runFile(argv[1]);
+  VM vm;
+  initVM(&vm);
+  vm.optimize = optimize;
+  vm.jit = jit;
+  *result = interpret(&vm, source->chars, source->length);
+  freeVM(&vm);
+
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  *length = (size_t)ftell(capture);
+  rewind(capture);
+  char* output = malloc(*length + 1);
+  if (output == NULL || fread(output, 1, *length, capture) != *length) {
+    fprintf(stderr, "Could not read back the captured output.\n");
+    exit(74);
+  }
+  output[*length] = '\0';
+  fclose(capture);
+  return output;
+}
+
+// --jit-diff runs the script through the interpreter and then through the JIT, each in a fresh VM,
+// and checks they agree on both the output and the result. The JIT's output is what gets printed.
+static void diffFile(VM* vm, const char* path) {
+  Source source = readSource(path);
+
+  InterpretResult expectedResult, actualResult;
+  size_t expectedLength, actualLength;
+  char* expected = captureRun(&source, vm->optimize, false, &expectedResult, &expectedLength);
+  char* actual = captureRun(&source, vm->optimize, true, &actualResult, &actualLength);
+  freeSource(&source);
+
+  fwrite(actual, 1, actualLength, stdout);
+  fflush(stdout);
+
+  bool same = expectedResult == actualResult && expectedLength == actualLength &&
+              memcmp(expected, actual, actualLength) == 0;
+  free(expected);
+  free(actual);
+
+  if (!same) {
+    fprintf(stderr, "JIT output differs from the interpreter for %s.\n", path);
+    exit(70);
+  }
+  fprintf(stderr, "JIT output matches the interpreter for %s.\n", path);
+
+  if (actualResult == INTERPRET_COMPILE_ERROR) exit(65);
+  if (actualResult == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
+// --emit-c writes the script out as C, --aot goes on to build it with the system C compiler.
+static void translateFile(VM* vm, const char* path, const char* output, bool emitOnly) {
+  Source source = readSource(path);
+  Chunk chunk;
+  initChunk(&chunk);
+  if (!compile(vm, source.chars, source.length, &chunk)) exit(65);
+  freeSource(&source);
+  if (vm->optimize) optimizeChunk(&chunk);
+
+  bool ok;
+  if (emitOnly) {
+    FILE* out = fopen(output, "w");
+    if (out == NULL) {
+      fprintf(stderr, "Could not open file \"%s\".\n", output);
+      exit(74);
+    }
+    ok = aotEmit(&chunk, out);
+    fclose(out);
   } else {
-    fprintf(stderr, "Usage: clox [path]\n");
+    ok = aotCompile(&chunk, output);
+  }
+  freeChunk(&chunk);
+  if (!ok) exit(70);
+}
+
+// ______________ Batch mode (--jobs N) __________________________
+
+// One script in a batch. The worker that runs it fills in everything below the path,
+// and the main thread prints it once done is set.
+typedef struct {
+  const char* path;
+  char* out;
+  size_t outLength;
+  char* err;
+  size_t errLength;
+  int exitCode;
+  double seconds;
+  bool done;
+} Job;
+
+// Each worker owns a run of consecutive jobs. It works through them front to back, so the
+// output the main thread is waiting on comes first, while idle workers steal from the back.
+typedef struct {
+  pthread_mutex_t lock;
+  int front;
+  int back; // one past the last job still waiting
+} Deque;
+
+typedef struct {
+  Job* jobs;
+  int jobCount;
+  Deque* deques;
+  int workerCount;
+  VM* settings; // every worker VM copies its options from this one
+  pthread_mutex_t doneLock;
+  pthread_cond_t doneChanged;
+} Batch;
+
+typedef struct {
+  Batch* batch;
+  int index;
+} Worker;
+
+static double now() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static int takeOwnJob(Deque* deque) {
+  pthread_mutex_lock(&deque->lock);
+  int job = deque->front < deque->back ? deque->front++ : -1;
+  pthread_mutex_unlock(&deque->lock);
+  return job;
+}
+
+static int stealJob(Deque* deque) {
+  pthread_mutex_lock(&deque->lock);
+  int job = deque->front < deque->back ? --deque->back : -1;
+  pthread_mutex_unlock(&deque->lock);
+  return job;
+}
+
+// Runs one script in a fresh VM with its output going to memory instead of the terminal.
+static void runJob(Batch* batch, Job* job) {
+  double start = now();
+  FILE* out = open_memstream(&job->out, &job->outLength);
+  FILE* err = open_memstream(&job->err, &job->errLength);
+
+  Source source;
+  if (strcmp(job->path, "-") == 0) {
+    fprintf(err, "Batch mode can't read a script from stdin.\n");
+    job->exitCode = 64;
+  } else if (!loadSource(job->path, &source, err)) {
+    job->exitCode = 74;
+  } else {
+    VM vm;
+    initVM(&vm);
+    vm.optimize = batch->settings->optimize;
+    vm.jit = batch->settings->jit;
+    vm.sharedStrings = batch->settings->sharedStrings;
+    vm.out = out;
+    vm.err = err;
+    InterpretResult result = interpret(&vm, source.chars, source.length);
+    freeVM(&vm);
+    freeSource(&source);
+    job->exitCode = result == INTERPRET_COMPILE_ERROR ? 65 : result == INTERPRET_RUNTIME_ERROR ? 70 : 0;
+  }
+
+  fclose(out);
+  fclose(err);
+  job->seconds = now() - start;
+
+  pthread_mutex_lock(&batch->doneLock);
+  job->done = true;
+  pthread_cond_broadcast(&batch->doneChanged);
+  pthread_mutex_unlock(&batch->doneLock);
+}
+
+static void* workerLoop(void* argument) {
+  Worker* worker = (Worker*)argument;
+  Batch* batch = worker->batch;
+
+  for (;;) {
+    int job = takeOwnJob(&batch->deques[worker->index]);
+    // Our own run is finished, go looking through everybody else's, starting with our neighbour.
+    for (int i = 1; job == -1 && i < batch->workerCount; i++) {
+      job = stealJob(&batch->deques[(worker->index + i) % batch->workerCount]);
+    }
+    // Jobs never get added once the batch starts, so if nobody has any left we're done.
+    if (job == -1) return NULL;
+    runJob(batch, &batch->jobs[job]);
+  }
+}
+
+static int compareSeconds(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(double* sorted, int count, double fraction) {
+  int index = (int)(fraction * (count - 1) + 0.5);
+  return sorted[index];
+}
+
+static void reportBatch(Batch* batch, double elapsed) {
+  int count = batch->jobCount;
+  double* seconds = malloc(sizeof(double) * count);
+  double total = 0;
+  int failed = 0;
+  for (int i = 0; i < count; i++) {
+    seconds[i] = batch->jobs[i].seconds;
+    total += seconds[i];
+    if (batch->jobs[i].exitCode != 0) failed++;
+  }
+  qsort(seconds, count, sizeof(double), compareSeconds);
+
+  fprintf(stderr, "batch: %d scripts (%d failed) on %d workers in %.3f s, %.1f scripts/s\n",
+          count, failed, batch->workerCount, elapsed, count / elapsed);
+  fprintf(stderr, "latency ms: min %.3f  median %.3f  p90 %.3f  p99 %.3f  max %.3f  mean %.3f\n",
+          seconds[0] * 1000, percentile(seconds, count, 0.5) * 1000, percentile(seconds, count, 0.9) * 1000,
+          percentile(seconds, count, 0.99) * 1000, seconds[count - 1] * 1000, total / count * 1000);
+  free(seconds);
+}
+
+// Runs every script on a pool of workers, each with an interpreter of its own. The output of each
+// script is held back and printed in the order the scripts were given, so a batch prints the same
+// whatever the number of workers. Returns the most serious exit code any of the scripts had.
+static int runBatch(const char** paths, int count, int workerCount, VM* settings) {
+  if (workerCount > count) workerCount = count;
+
+  Batch batch;
+  batch.jobs = calloc(count, sizeof(Job));
+  batch.jobCount = count;
+  batch.deques = malloc(sizeof(Deque) * workerCount);
+  batch.workerCount = workerCount;
+  batch.settings = settings;
+  pthread_mutex_init(&batch.doneLock, NULL);
+  pthread_cond_init(&batch.doneChanged, NULL);
+
+  for (int i = 0; i < count; i++) batch.jobs[i].path = paths[i];
+  for (int i = 0; i < workerCount; i++) {
+    pthread_mutex_init(&batch.deques[i].lock, NULL);
+    batch.deques[i].front = (int)((long)count * i / workerCount);
+    batch.deques[i].back = (int)((long)count * (i + 1) / workerCount);
+  }
+
+  double start = now();
+  pthread_t* threads = malloc(sizeof(pthread_t) * workerCount);
+  Worker* workers = malloc(sizeof(Worker) * workerCount);
+  for (int i = 0; i < workerCount; i++) {
+    workers[i] = (Worker){&batch, i};
+    pthread_create(&threads[i], NULL, workerLoop, &workers[i]);
+  }
+
+  int exitCode = 0;
+  for (int i = 0; i < count; i++) {
+    Job* job = &batch.jobs[i];
+    pthread_mutex_lock(&batch.doneLock);
+    while (!job->done) pthread_cond_wait(&batch.doneChanged, &batch.doneLock);
+    pthread_mutex_unlock(&batch.doneLock);
+
+    fwrite(job->out, 1, job->outLength, stdout);
+    fflush(stdout);
+    fwrite(job->err, 1, job->errLength, stderr);
+    free(job->out);
+    free(job->err);
+    if (job->exitCode > exitCode) exitCode = job->exitCode;
+  }
+
+  for (int i = 0; i < workerCount; i++) pthread_join(threads[i], NULL);
+  reportBatch(&batch, now() - start);
+
+  for (int i = 0; i < workerCount; i++) pthread_mutex_destroy(&batch.deques[i].lock);
+  pthread_mutex_destroy(&batch.doneLock);
+  pthread_cond_destroy(&batch.doneChanged);
+  free(threads);
+  free(workers);
+  free(batch.deques);
+  free(batch.jobs);
+  return exitCode;
+}
+
+int main(int argc, const char* argv[]) {
+  VM vm;
+  initVM(&vm);
+
+  const char* path = NULL;
+  // In batch mode every path on the command line is a script to run.
+  const char** paths = malloc(sizeof(const char*) * argc);
+  int pathCount = 0;
+  int jobs = 0;
+  bool diff = false;
+  const char* output = NULL;
+  bool emitOnly = false;
+  const char* samplePath = NULL;
+  for (int i = 1; i < argc; i++) {
+    // a lone "-" is a path, it means read the script from stdin
+    if (strcmp(argv[i], "-O") == 0) {
+      vm.optimize = true;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      vm.jit = true;
+    } else if (strcmp(argv[i], "--shared-strings") == 0) {
+      if (!sharedStringsReady()) initSharedStrings(SHARED_STRINGS_CAPACITY);
+      vm.sharedStrings = true;
+    } else if (strcmp(argv[i], "--profile") == 0 || strcmp(argv[i], "--profile=cycles") == 0) {
+      if (vm.profile == NULL) vm.profile = newProfile(false);
+      if (strcmp(argv[i], "--profile=cycles") == 0) vm.profile->timed = true;
+    } else if (strcmp(argv[i], "--loop-stats") == 0) {
+      if (vm.loops == NULL) vm.loops = newLoopStats();
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (strcmp(argv[i], "--sample") == 0 && i + 1 < argc) {
+      samplePath = argv[++i];
+    } else if (strcmp(argv[i], "--jit-diff") == 0) {
+      diff = true;
+    } else if ((strcmp(argv[i], "--emit-c") == 0 || strcmp(argv[i], "--aot") == 0) && i + 1 < argc) {
+      emitOnly = strcmp(argv[i], "--emit-c") == 0;
+      output = argv[++i];
+    } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+      if (jobs < 1) {
+        fprintf(stderr, "--jobs needs at least one worker.\n");
+        exit(64);
+      }
+    } else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+      fprintf(stderr, "Unknown option \"%s\".\n", argv[i]);
+      exit(64);
+    } else {
+      paths[pathCount++] = argv[i];
+    }
+  }
+
+  if (tracePath != NULL) {
+    if (vm.profile != NULL) {
+      fprintf(stderr, "--trace and --profile each need a dispatch loop of their own, pick one.\n");
+      exit(64);
+    }
+    vm.trace = newTrace(TRACE_CAPACITY);
+  }
+
+  if (jobs > 0) {
+    if (pathCount == 0) {
+      fprintf(stderr, "--jobs needs scripts to run.\n");
+      exit(64);
+    }
+    int exitCode = runBatch(paths, pathCount, jobs, &vm);
+    free(paths);
+    freeVM(&vm);
+    if (sharedStringsReady()) freeSharedStrings();
+    return exitCode;
+  }
+
+  if (pathCount > 1) {
+    fprintf(stderr, "Usage: clox [-O] [--profile[=cycles]] [--loop-stats] [--sample out.folded] [--trace out.trace] [--jit | --jit-diff | --emit-c out.c | --aot out] [path | -]\n");
+    fprintf(stderr, "       clox [-O] [--jit] --jobs N path...\n");
     exit(64);
   }
+  if (pathCount == 1) path = paths[0];
+  free(paths);
+
+  if (output != NULL) {
+    if (path == NULL) {
+      fprintf(stderr, "%s needs a script to translate.\n", emitOnly ? "--emit-c" : "--aot");
+      exit(64);
+    }
+    translateFile(&vm, path, output, emitOnly);
+  } else if (diff) {
+    if (path == NULL) {
+      fprintf(stderr, "--jit-diff needs a script to run.\n");
+      exit(64);
+    }
+    diffFile(&vm, path);
+  } else if (samplePath != NULL) {
+    sampleFile(&vm, path, samplePath);
+  } else if (path == NULL) {
+    repl(&vm);
+  } else {
+    runFile(&vm, path);
+  }
 
   // Note how the output of the OP_ADD implicitly flows into being an operand of OP_DIVIDE without either instruction being directly coupled to each other.
   // That’s the magic of the stack. It lets us freely compose instructions without them needing any complexity or awareness of the data flow. 
   // The stack acts like a shared workspace that they all read from and write to.
 
-  freeVM();
+  if (vm.profile != NULL) freeProfile(vm.profile);
+  if (vm.trace != NULL) freeTrace(vm.trace);
+  if (vm.loops != NULL) freeLoopStats(vm.loops);
+  freeVM(&vm);
+  if (sharedStringsReady()) freeSharedStrings();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+// Decodes a --trace file. The trace carries its own copy of every chunk it saw, so this rebuilds them and
+// runs each event back through disassembleInstruction(), oldest first, with the type that was on top of
+// the stack when the instruction started.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../headers/common.h"
+#include "../headers/chunk.h"
+#include "../headers/memory.h"
+#include "../headers/object.h"
+#include "../headers/trace.h"
+#include "../headers/vm.h"
+#include "../disassembler/debug.h"
+
+static FILE* file;
+static const char* path;
+
+static void truncated() {
+  fprintf(stderr, "\"%s\" is truncated or not a trace.\n", path);
+  exit(65);
+}
+
+static void readBytes(void* bytes, size_t length) {
+  if (length > 0 && fread(bytes, 1, length, file) < length) truncated();
+}
+
+static uint32_t readInt() {
+  uint32_t value;
+  readBytes(&value, sizeof(value));
+  return value;
+}
+
+// The reverse of traceChunk(). Strings are interned in vm, which owns them from then on.
+static void readChunk(VM* vm, Chunk* chunk) {
+  initChunk(chunk);
+  chunk->count = chunk->capacity = (int)readInt();
+  chunk->code = ALLOCATE(uint8_t, chunk->count);
+  readBytes(chunk->code, chunk->count);
+
+  chunk->lineCount = chunk->lineCapacity = (int)readInt();
+  chunk->lines = ALLOCATE(LineStart, chunk->lineCount);
+  readBytes(chunk->lines, sizeof(LineStart) * chunk->lineCount);
+
+  uint32_t constantCount = readInt();
+  for (uint32_t i = 0; i < constantCount; i++) {
+    uint8_t type;
+    readBytes(&type, 1);
+    Value constant = NIL_VAL;
+    switch (type) {
+      case VAL_BOOL: {
+        bool boolean;
+        readBytes(&boolean, sizeof(bool));
+        constant = BOOL_VAL(boolean);
+        break;
+      }
+      case VAL_NIL: break;
+      case VAL_NUMBER: {
+        double number;
+        readBytes(&number, sizeof(double));
+        constant = NUMBER_VAL(number);
+        break;
+      }
+      case VAL_INT: {
+        int64_t integer;
+        readBytes(&integer, sizeof(int64_t));
+        constant = INT_VAL(integer);
+        break;
+      }
+      case VAL_OBJ: {
+        int length = (int)readInt();
+        char* chars = ALLOCATE(char, length + 1);
+        readBytes(chars, length);
+        chars[length] = '\0';
+        constant = OBJ_VAL(takeString(vm, chars, length));
+        break;
+      }
+      default: truncated();
+    }
+    writeValueArray(&chunk->constants, constant);
+  }
+}
+
+static const char* typeName(uint8_t top) {
+  switch (top) {
+    case VAL_BOOL: return "bool";
+    case VAL_NIL: return "nil";
+    case VAL_NUMBER: return "number";
+    case VAL_INT: return "int";
+    case VAL_OBJ: return "object";
+    case TRACE_EMPTY_STACK: return "empty";
+    default: return "?";
+  }
+}
+
+int main(int argc, const char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "Usage: tracedump file.trace\n");
+    exit(64);
+  }
+  path = argv[1];
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    fprintf(stderr, "Could not open file \"%s\".\n", path);
+    exit(74);
+  }
+
+  char magic[sizeof(TRACE_MAGIC) - 1];
+  readBytes(magic, sizeof(magic));
+  if (memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) truncated();
+
+  VM vm;
+  initVM(&vm);
+  uint32_t chunkCount = readInt();
+  Chunk* chunks = ALLOCATE(Chunk, chunkCount);
+  for (uint32_t i = 0; i < chunkCount; i++) readChunk(&vm, &chunks[i]);
+
+  uint64_t recorded;
+  readBytes(&recorded, sizeof(recorded));
+  uint32_t kept = readInt();
+  printf("== %u chunks, %llu instructions traced, last %u kept ==\n",
+         chunkCount, (unsigned long long)recorded, kept);
+
+  // Numbered from the start of the run, not from the start of the ring.
+  uint64_t sequence = recorded - kept;
+  for (uint32_t i = 0; i < kept; i++, sequence++) {
+    TraceEvent event;
+    readBytes(&event, sizeof(event));
+    printf("%10llu  chunk %-3u top %-6s ", (unsigned long long)sequence, event.chunk, typeName(event.top));
+
+    if (event.chunk >= chunkCount || event.offset >= (uint32_t)chunks[event.chunk].count) {
+      printf("%s at %u, chunk not in the trace\n", opcodeName(event.opcode), event.offset);
+    } else {
+      disassembleInstruction(&chunks[event.chunk], (int)event.offset);
+    }
+  }
+
+  for (uint32_t i = 0; i < chunkCount; i++) freeChunk(&chunks[i]);
+  FREE_ARRAY(Chunk, chunks, chunkCount);
+  freeVM(&vm);
+  fclose(file);
+  return 0;
+}